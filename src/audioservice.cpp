@@ -34,14 +34,118 @@
 
 #include "audioservice.h"
 #include "feedbackeffect.h"
+#include "samplecache.h"
+#include "feedbackstream.h"
+#include "feedbacksequence.h"
+#include "feedbackscheduler.h"
+#include "volumeramp.h"
+#include "rolevolumes.h"
+#include "volumecurve.h"
+#include "statestore.h"
+#include "pulsemirror.h"
+#include "settings.h"
 
 #include "lunaserviceutils.h"
 #include "utils.h"
 
+/* Step of volumeUp/volumeDown on the 0-100 scale, which the volume curve
+ * turns into perceptually even steps */
 #define VOLUME_STEP		11
+/* Limits for the samples of a single playSequence call and the silence
+ * between them in milliseconds */
+#define MAX_SEQUENCE_LENGTH	32
+#define MAX_SEQUENCE_GAP	10000
+
+/* Longest volume ramp in milliseconds */
+#define MAX_RAMP_DURATION	60000
+
+#define SETTINGS_PATH		"/etc/audio-service.conf"
+#define STATE_PATH		"/var/lib/audio-service/state"
 
 extern GMainLoop *event_loop;
 
+/* Fields of the getStatus reply a subscriber can pick */
+enum StatusField {
+    STATUS_FIELD_VOLUME = 1 << 0,
+    STATUS_FIELD_BALANCE = 1 << 1,
+    STATUS_FIELD_FADE = 1 << 2,
+    STATUS_FIELD_CHANNELS = 1 << 3,
+    STATUS_FIELD_MUTE = 1 << 4,
+    STATUS_FIELD_IN_CALL = 1 << 5,
+    STATUS_FIELD_SPEAKER_MODE = 1 << 6,
+    STATUS_FIELD_MIC_MUTE = 1 << 7,
+    STATUS_FIELD_RAMP_TARGET = 1 << 8,
+    STATUS_FIELD_ALL = (1 << 9) - 1
+};
+
+/* indexed by the bit of the field */
+static const char *status_field_names[] = {
+    "volume",
+    "balance",
+    "fade",
+    "channels",
+    "mute",
+    "inCall",
+    "speakerMode",
+    "micMute",
+    "rampTarget"
+};
+
+/* Subscription key of getStatus subscribers which asked for some fields */
+#define FILTERED_STATUS_KEY	"getStatus/fields"
+
+/* A getStatus subscriber which asked for some fields only */
+struct status_subscriber {
+    unsigned int fields;
+    unsigned int seq;
+    bool resync;
+    /* last time it was seen among the subscriptions */
+    unsigned int generation;
+};
+
+static bool status_fields_parse(jvalue_ref fields_obj, unsigned int *fields)
+{
+    ssize_t n, count;
+    unsigned int field;
+
+    if (!jis_array(fields_obj))
+        return false;
+
+    count = jarray_size(fields_obj);
+    *fields = 0;
+
+    for (n = 0; n < count; n++) {
+        jvalue_ref field_obj = jarray_get(fields_obj, n);
+        raw_buffer name;
+        bool found = false;
+
+        if (!jis_string(field_obj))
+            return false;
+
+        name = jstring_get_fast(field_obj);
+
+        for (field = 0; field < G_N_ELEMENTS(status_field_names); field++) {
+            if (strlen(status_field_names[field]) == (size_t) name.m_len &&
+                strncmp(status_field_names[field], name.m_str, name.m_len) == 0) {
+                *fields |= 1 << field;
+                found = true;
+                break;
+            }
+        }
+
+        if (!found)
+            return false;
+    }
+
+    return *fields != 0;
+}
+
+/* Category data of the luna service methods of a role */
+struct role_volume_data {
+    AudioService *service;
+    VolumeRole role;
+};
+
 struct play_feedback_data {
     AudioService *service;
     LSHandle *handle;
@@ -60,6 +164,7 @@ static LSMethod audio_service_methods[]  = {
     { "setVolume", &AudioService::set_volume_cb },
     { "setMute", &AudioService::set_mute_cb },
     { "playFeedback", &AudioService::play_feedback_cb },
+    { "playSequence", &AudioService::play_sequence_cb },
     { "volumeUp", &AudioService::volume_up_cb },
     { "volumeDown", &AudioService::volume_down_cb },
     { "setCallMode", &AudioService::set_call_mode_cb },
@@ -67,8 +172,30 @@ static LSMethod audio_service_methods[]  = {
     { NULL, NULL }
 };
 
+static LSMethod audio_service_state_methods[] = {
+    { "getVolumeBalance", &AudioService::get_volume_balance_cb },
+    { "setVolumeBalance", &AudioService::set_volume_balance_cb },
+    { "volumeRamp", &AudioService::volume_ramp_cb },
+    { NULL, NULL }
+};
+
+static LSMethod audio_service_role_methods[] = {
+    { "getVolume", &AudioService::get_role_volume_cb },
+    { "setVolume", &AudioService::set_role_volume_cb },
+    { NULL, NULL }
+};
+
+/* indexed by VolumeRole */
+static const char *role_categories[] = {
+    "/media",
+    "/ringtone",
+    "/phone",
+    "/system"
+};
+
 static LSMethod system_sounds_methods[] = {
     { "playFeedback", &AudioService::play_feedback_cb },
+    { "playSequence", &AudioService::play_sequence_cb },
     { NULL, NULL }
 };
 
@@ -82,19 +209,58 @@ AudioService::AudioService() :
     new_volume(0),
     mute(0),
     new_mute(0),
-    mDefaultSinkName(0),
     default_sink_index(0),
     in_call(false),
     speaker_mode(false),
     mic_mute(false),
-    volume_locked(false)
+    volume_balance(0.0f),
+    volume_fade(0.0f),
+    volume_target(0),
+    volume_target_raw(PA_VOLUME_NORM),
+    volume_target_pending(false),
+    volume_in_flight(false),
+    volume_optimistic(false),
+    published_volume(-1),
+    volume_ramp(0),
+    status_payload(0),
+    status_payload_subscribed(0),
+    status_version(0),
+    status_subscribers(0),
+    status_generation(0),
+    notify_window(0),
+    notify_timeout(0),
+    notify_pending(false),
+    volume_ramp_req(0),
+    mSampleCache(0),
+    mFeedbackStream(0),
+    mFeedbackEffects(0),
+    mFeedbackScheduler(0),
+    mSettings(0),
+    mRoleVolumes(0),
+    mVolumeCurve(0),
+    mState(0),
+    mMirror(0),
+    state_restored(false),
+    mRoleData(0)
 {
     LSError error;
     pa_mainloop_api *mainloop_api;
     char name[100];
+    unsigned int n;
+    char *curve_name;
+    char *state_path;
+    VolumeCurveType curve_type = VOLUME_CURVE_CUBIC;
 
     LSErrorInit(&error);
 
+    pa_channel_map_init(&sink_channel_map);
+    pa_cvolume_init(&sink_volume);
+    pa_cvolume_init(&new_sink_volume);
+    g_queue_init(&volume_waiters);
+    memset(&status_key, 0, sizeof(status_key));
+    memset(&posted_key, 0, sizeof(posted_key));
+    status_subscribers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
     if (!LSRegister("org.webosports.service.audio", &handle, &error)) {
         g_warning("Failed to register the luna service: %s", error.message);
         LSErrorFree(&error);
@@ -114,12 +280,58 @@ AudioService::AudioService() :
         goto error;
     }
 
+    if (!LSRegisterCategory(handle, "/state", audio_service_state_methods,
+            NULL, NULL, &error)) {
+        g_warning("Could not register service category: %s", error.message);
+        LSErrorFree(&error);
+        goto error;
+    }
+
+    if (!LSCategorySetData(handle, "/state", this, &error)) {
+        g_warning("Could not set data for service category: %s", error.message);
+        LSErrorFree(&error);
+        goto error;
+    }
+
     if (!LSRegister("com.palm.audio", &palmHandle, &error)) {
         g_warning("Failed to register the luna service: %s", error.message);
         LSErrorFree(&error);
         goto error;
     }
 
+    /* older clients reach the state methods through the palm name */
+    if (!LSRegisterCategory(palmHandle, "/state", audio_service_state_methods,
+            NULL, NULL, &error)) {
+        g_warning("Could not register service category: %s", error.message);
+        LSErrorFree(&error);
+        goto error;
+    }
+
+    if (!LSCategorySetData(palmHandle, "/state", this, &error)) {
+        g_warning("Could not set data for service category: %s", error.message);
+        LSErrorFree(&error);
+        goto error;
+    }
+
+    /* the same volume of a role is available through both names */
+    mRoleData = g_new0(struct role_volume_data, VOLUME_ROLE_COUNT);
+
+    for (n = 0; n < VOLUME_ROLE_COUNT; n++) {
+        mRoleData[n].service = this;
+        mRoleData[n].role = (VolumeRole) n;
+
+        if (!LSRegisterCategory(handle, role_categories[n], audio_service_role_methods,
+                NULL, NULL, &error) ||
+            !LSCategorySetData(handle, role_categories[n], &mRoleData[n], &error) ||
+            !LSRegisterCategory(palmHandle, role_categories[n], audio_service_role_methods,
+                NULL, NULL, &error) ||
+            !LSCategorySetData(palmHandle, role_categories[n], &mRoleData[n], &error)) {
+            g_warning("Could not register service category %s: %s", role_categories[n], error.message);
+            LSErrorFree(&error);
+            goto error;
+        }
+    }
+
     if (!LSRegisterCategory(palmHandle, "/systemsounds", system_sounds_methods,
             NULL, NULL, &error)) {
         g_warning("Could not register service category: %s", error.message);
@@ -145,6 +357,35 @@ AudioService::AudioService() :
         goto error;
     }
 
+    mSettings = new Settings();
+    mSettings->load(SETTINGS_PATH);
+
+    mRoleVolumes = new RoleVolumes(this);
+
+    curve_name = mSettings->get_string("Volume", "Curve", "cubic");
+    if (!volume_curve_parse(curve_name, strlen(curve_name), &curve_type)) {
+        g_warning("Unknown volume curve %s, using cubic", curve_name);
+        curve_type = VOLUME_CURVE_CUBIC;
+    }
+    g_free(curve_name);
+
+    mVolumeCurve = new VolumeCurve(curve_type);
+
+    volume_optimistic = mSettings->get_boolean("Volume", "OptimisticReplies", false);
+    notify_window = MAX(mSettings->get_integer("Notifications", "Window", 16), 0);
+
+    state_path = mSettings->get_string("State", "Path", STATE_PATH);
+    mState = new StateStore(state_path);
+    g_free(state_path);
+
+    if (mState->load())
+        restore_state();
+
+    mSampleCache = new SampleCache(this);
+    mFeedbackStream = new FeedbackStream(this);
+    mFeedbackEffects = new FeedbackEffectPool(this);
+    mFeedbackScheduler = new FeedbackScheduler(this);
+
     pa_mainloop = pa_glib_mainloop_new(g_main_context_default());
     mainloop_api = pa_glib_mainloop_get_api(pa_mainloop);
 
@@ -153,6 +394,27 @@ AudioService::AudioService() :
     context_initialized = false;
     pa_context_set_state_callback(mContext, context_state_cb, this);
 
+    mMirror = new PulseMirror(mContext);
+    mMirror->set_listener([this] (PulseObjectType type, uint32_t index, PulseObjectChange change) {
+        const PulseSink *sink;
+
+        switch (type) {
+        case PULSE_OBJECT_SERVER:
+        case PULSE_OBJECT_SINK:
+            /* another default sink or a change of the current one */
+            sink = mMirror->default_sink();
+            if (sink && (type == PULSE_OBJECT_SERVER || sink->index == index))
+                default_sink_changed(sink);
+            break;
+        case PULSE_OBJECT_SINK_INPUT:
+            if (change == PULSE_OBJECT_ADDED)
+                mRoleVolumes->sink_input_added(mMirror->sink_input(index));
+            break;
+        default:
+            break;
+        }
+    });
+
     if (pa_context_connect(mContext, NULL, (pa_context_flags_t) 0, NULL) < 0) {
         g_warning("Failed to connect to PulseAudio");
         pa_context_unref(mContext);
@@ -160,45 +422,980 @@ AudioService::AudioService() :
         goto error;
     }
 
-    return;
+    return;
+
+error:
+    if (handle != NULL) {
+        LSUnregister(handle, &error);
+        LSErrorFree(&error);
+    }
+}
+
+AudioService::~AudioService()
+{
+    LSError error;
+
+    LSErrorInit(&error);
+
+    if (handle != NULL && !LSUnregister(handle, &error)) {
+        g_warning("Could not unregister service: %s", error.message);
+        LSErrorFree(&error);
+    }
+
+    g_free(status_payload);
+    g_free(status_payload_subscribed);
+    g_hash_table_destroy(status_subscribers);
+
+    if (notify_timeout)
+        g_source_remove(notify_timeout);
+
+    cancel_volume_ramp();
+
+    while (!g_queue_is_empty(&volume_waiters))
+        luna_service_req_data_free((struct luna_service_req_data*) g_queue_pop_head(&volume_waiters));
+
+    delete mFeedbackScheduler;
+    delete mFeedbackEffects;
+    delete mFeedbackStream;
+    delete mSampleCache;
+    delete mSettings;
+    delete mState;
+    delete mRoleVolumes;
+    delete mVolumeCurve;
+    delete mMirror;
+    g_free(mRoleData);
+
+    if (mContext)
+        pa_context_unref(mContext);
+}
+
+const char* AudioService::default_sink_name() const
+{
+    return mMirror ? mMirror->default_sink_name() : NULL;
+}
+
+bool AudioService::play_feedback_cb(LSHandle *handle, LSMessage *message, void *user_data)
+{
+    AudioService *service = static_cast<AudioService*>(user_data);
+    const char *payload;
+    jvalue_ref parsed_obj;
+    raw_buffer name, sink, priority_name;
+    bool play, low_latency;
+    FeedbackPriority priority;
+    FeedbackEffect *effect = 0;
+
+    if (!service->context_initialized) {
+        luna_service_message_reply_custom_error(handle, message, "Not yet initialized");
+        return true;
+    }
+
+    payload = LSMessageGetPayload(message);
+    parsed_obj = luna_service_message_parse_and_validate(payload);
+    if (jis_null(parsed_obj)) {
+        luna_service_message_reply_error_bad_json(handle, message);
+        goto cleanup;
+    }
+
+    /* strings are only borrowed from the parsed payload, the effect copies
+     * them into buffers it keeps across requests */
+    name = luna_service_message_get_string_buffer(parsed_obj, "name");
+    if (!name.m_str) {
+        luna_service_message_reply_custom_error(handle, message, "Invalid parameters: name parameter is required");
+        goto cleanup;
+    }
+
+    play = luna_service_message_get_boolean(parsed_obj, "play", true);
+    sink = luna_service_message_get_string_buffer(parsed_obj, "sink");
+    low_latency = luna_service_message_get_boolean(parsed_obj, "lowLatency", false);
+
+    priority_name = luna_service_message_get_string_buffer(parsed_obj, "priority");
+    if (priority_name.m_str && !feedback_priority_parse(priority_name.m_str, priority_name.m_len, &priority)) {
+        luna_service_message_reply_custom_error(handle, message,
+            "Invalid parameters: priority must be one of low, normal, high or critical");
+        goto cleanup;
+    }
+
+    effect = service->mFeedbackEffects->acquire();
+    effect->prepare(name.m_str, name.m_len, sink.m_str, sink.m_len, play, low_latency);
+    if (priority_name.m_str)
+        effect->set_priority(priority);
+    effect->set_user_data(message);
+
+    LSMessageRef(message);
+
+    effect->run([service, effect](bool success) {
+        LSMessage *message = static_cast<LSMessage*>(effect->user_data());
+
+        if (success && effect->latency() != PA_USEC_INVALID) {
+            jvalue_ref reply_obj = jobject_create();
+
+            jobject_put(reply_obj, J_CSTR_TO_JVAL("latency"), jnumber_create_i64(effect->latency()));
+            jobject_put(reply_obj, J_CSTR_TO_JVAL("returnValue"), jboolean_create(true));
+
+            luna_service_message_validate_and_send(LSMessageGetConnection(message), message, reply_obj);
+
+            j_release(&reply_obj);
+        }
+        else if (success)
+            luna_service_message_reply_success(message);
+        else
+            luna_service_message_reply_error_internal(message);
+
+        LSMessageUnref(message);
+
+        service->mFeedbackEffects->release(effect);
+    });
+
+cleanup:
+    if (!jis_null(parsed_obj))
+        j_release(&parsed_obj);
+
+    return true;
+}
+
+bool AudioService::play_sequence_cb(LSHandle *handle, LSMessage *message, void *user_data)
+{
+    AudioService *service = static_cast<AudioService*>(user_data);
+    const char *payload;
+    jvalue_ref parsed_obj;
+    jvalue_ref sequence_obj, item_obj, gap_obj;
+    raw_buffer name;
+    char *sink = 0;
+    int32_t gap;
+    ssize_t n, count;
+    FeedbackSequence *sequence = 0;
+
+    if (!service->context_initialized) {
+        luna_service_message_reply_custom_error(handle, message, "Not yet initialized");
+        return true;
+    }
+
+    payload = LSMessageGetPayload(message);
+    parsed_obj = luna_service_message_parse_and_validate(payload);
+    if (jis_null(parsed_obj)) {
+        luna_service_message_reply_error_bad_json(handle, message);
+        goto cleanup;
+    }
+
+    if (!jobject_get_exists(parsed_obj, J_CSTR_TO_BUF("sequence"), &sequence_obj) ||
+        !jis_array(sequence_obj)) {
+        luna_service_message_reply_custom_error(handle, message, "Invalid parameters: sequence parameter is required");
+        goto cleanup;
+    }
+
+    count = jarray_size(sequence_obj);
+    if (count < 1 || count > MAX_SEQUENCE_LENGTH) {
+        luna_service_message_reply_custom_error(handle, message, "Invalid parameters: sequence must have between 1 and "
+                                                G_STRINGIFY(MAX_SEQUENCE_LENGTH) " entries");
+        goto cleanup;
+    }
+
+    sink = luna_service_message_get_string(parsed_obj, "sink", "");
+    sequence = new FeedbackSequence(service, sink);
+
+    for (n = 0; n < count; n++) {
+        item_obj = jarray_get(sequence_obj, n);
+
+        if (!jis_object(item_obj)) {
+            luna_service_message_reply_error_bad_json(handle, message);
+            goto cleanup;
+        }
+
+        name = luna_service_message_get_string_buffer(item_obj, "name");
+        if (!name.m_str) {
+            luna_service_message_reply_custom_error(handle, message, "Invalid parameters: every entry needs a name");
+            goto cleanup;
+        }
+
+        /* silence in milliseconds before the sample */
+        gap = 0;
+        if (jobject_get_exists(item_obj, J_CSTR_TO_BUF("gap"), &gap_obj) && jis_number(gap_obj))
+            jnumber_get_i32(gap_obj, &gap);
+
+        if (gap < 0 || gap > MAX_SEQUENCE_GAP) {
+            luna_service_message_reply_custom_error(handle, message, "Invalid parameters: gap out of range. Must be in [0;"
+                                                    G_STRINGIFY(MAX_SEQUENCE_GAP) "]");
+            goto cleanup;
+        }
+
+        sequence->add(std::string(name.m_str, name.m_len), gap);
+    }
+
+    LSMessageRef(message);
+
+    sequence->run([message](FeedbackSequence *sequence, bool success) {
+        if (success)
+            luna_service_message_reply_success(message);
+        else
+            luna_service_message_reply_error_internal(message);
+
+        LSMessageUnref(message);
+
+        delete sequence;
+    });
+
+    sequence = 0;
+
+cleanup:
+    delete sequence;
+    g_free(sink);
+
+    if (!jis_null(parsed_obj))
+        j_release(&parsed_obj);
+
+    return true;
+}
+
+bool AudioService::get_status_cb(LSHandle *handle, LSMessage *message, void *user_data)
+{
+    AudioService *service = static_cast<AudioService*>(user_data);
+    const char *payload;
+    jvalue_ref parsed_obj = NULL;
+    jvalue_ref fields_obj = NULL;
+    unsigned int fields = 0;
+    bool subscribed = false;
+
+    /* a restored snapshot is good enough until pulseaudio tells otherwise */
+    if (!service->context_initialized && !service->state_restored) {
+        luna_service_message_reply_custom_error(handle, message, "Not yet initialized");
+        return true;
+    }
+
+    payload = LSMessageGetPayload(message);
+    parsed_obj = luna_service_message_parse_and_validate(payload);
+    if (jis_null(parsed_obj)) {
+        luna_service_message_reply_error_bad_json(handle, message);
+        goto cleanup;
+    }
+
+    if (!jobject_get_exists(parsed_obj, J_CSTR_TO_BUF("fields"), &fields_obj)) {
+        subscribed = luna_service_check_for_subscription_and_process(handle, message);
+        luna_service_message_reply_payload(handle, message, service->get_status_payload(subscribed));
+        goto cleanup;
+    }
+
+    if (!status_fields_parse(fields_obj, &fields)) {
+        luna_service_message_reply_custom_error(handle, message,
+            "Invalid parameters: fields must be a non-empty list of status fields");
+        goto cleanup;
+    }
+
+    if (LSMessageIsSubscription(message))
+        service->subscribe_status(handle, message, fields);
+    else
+        service->send_status_fields(handle, message, fields, NULL);
+
+cleanup:
+    if (!jis_null(parsed_obj))
+        j_release(&parsed_obj);
+
+    return true;
+}
+
+void AudioService::fill_status_key(StatusKey *key) const
+{
+    unsigned int n;
+
+    /* zeroed as a whole so it can be compared as a whole */
+    memset(key, 0, sizeof(*key));
+    key->volume = reported_volume();
+    key->mute = mute;
+    key->in_call = in_call;
+    key->speaker_mode = speaker_mode;
+    key->mic_mute = mic_mute;
+    key->balance = volume_balance;
+    key->fade = volume_fade;
+    key->ramp_target = volume_ramp ? volume_ramp->target() : PA_VOLUME_INVALID;
+
+    if (pa_cvolume_compatible_with_channel_map(&sink_volume, &sink_channel_map)) {
+        key->channel_map.channels = sink_channel_map.channels;
+        key->channel_volume.channels = sink_volume.channels;
+
+        for (n = 0; n < sink_volume.channels; n++) {
+            key->channel_map.map[n] = sink_channel_map.map[n];
+            key->channel_volume.values[n] = sink_volume.values[n];
+        }
+    }
+}
+
+/* Fields which differ between two snapshots of the status */
+unsigned int AudioService::status_key_diff(const StatusKey *a, const StatusKey *b)
+{
+    unsigned int changed = 0;
+
+    if (a->volume != b->volume)
+        changed |= STATUS_FIELD_VOLUME;
+    if (a->balance != b->balance)
+        changed |= STATUS_FIELD_BALANCE;
+    if (a->fade != b->fade)
+        changed |= STATUS_FIELD_FADE;
+    if (memcmp(&a->channel_map, &b->channel_map, sizeof(a->channel_map)) != 0 ||
+        memcmp(&a->channel_volume, &b->channel_volume, sizeof(a->channel_volume)) != 0)
+        changed |= STATUS_FIELD_CHANNELS;
+    if (a->mute != b->mute)
+        changed |= STATUS_FIELD_MUTE;
+    if (a->in_call != b->in_call)
+        changed |= STATUS_FIELD_IN_CALL;
+    if (a->speaker_mode != b->speaker_mode)
+        changed |= STATUS_FIELD_SPEAKER_MODE;
+    if (a->mic_mute != b->mic_mute)
+        changed |= STATUS_FIELD_MIC_MUTE;
+    if (a->ramp_target != b->ramp_target)
+        changed |= STATUS_FIELD_RAMP_TARGET;
+
+    return changed;
+}
+
+/* Status replies are asked for far more often than the status changes, so
+ * the serialized reply is kept until something in it does */
+const char* AudioService::get_status_payload(bool subscribed)
+{
+    StatusKey key;
+    jvalue_ref reply_obj = NULL;
+
+    fill_status_key(&key);
+
+    if (status_payload && memcmp(&key, &status_key, sizeof(key)) == 0)
+        return subscribed ? status_payload_subscribed : status_payload;
+
+    status_key = key;
+    status_version++;
+
+    reply_obj = jobject_create();
+
+    put_status_fields(reply_obj, STATUS_FIELD_ALL, false);
+    jobject_put(reply_obj, J_CSTR_TO_JVAL("returnValue"), jboolean_create(true));
+
+    g_free(status_payload);
+    status_payload = g_strdup(jvalue_tostring_simple(reply_obj));
+
+    jobject_put(reply_obj, J_CSTR_TO_JVAL("subscribed"), jboolean_create(true));
+
+    g_free(status_payload_subscribed);
+    status_payload_subscribed = g_strdup(jvalue_tostring_simple(reply_obj));
+
+    j_release(&reply_obj);
+
+    g_debug("Status payload version %u: %s", status_version, status_payload);
+
+    return subscribed ? status_payload_subscribed : status_payload;
+}
+
+void AudioService::subscribe_status(LSHandle *handle, LSMessage *message, unsigned int fields)
+{
+    struct status_subscriber *subscriber;
+    LSError error;
+
+    LSErrorInit(&error);
+
+    /* kept apart from the full getStatus subscriptions which all get the
+     * same payload */
+    if (!LSSubscriptionAdd(handle, FILTERED_STATUS_KEY, message, &error)) {
+        LSErrorPrint(&error, stderr);
+        LSErrorFree(&error);
+        luna_service_message_reply_error_internal(handle, message);
+        return;
+    }
+
+    subscriber = g_new0(struct status_subscriber, 1);
+    subscriber->fields = fields;
+    subscriber->generation = status_generation;
+
+    g_hash_table_replace(status_subscribers, g_strdup(LSMessageGetUniqueToken(message)), subscriber);
+
+    send_status_fields(handle, message, fields, subscriber);
+}
+
+/* Full state of the fields asked for when subscriber is NULL or needs to
+ * catch up, otherwise a delta of those fields numbered in sequence. A
+ * subscriber missing a delta gets the full state with the next one. */
+bool AudioService::send_status_fields(LSHandle *handle, LSMessage *message, unsigned int fields,
+                                      struct status_subscriber *subscriber)
+{
+    jvalue_ref reply_obj = NULL;
+    LSError error;
+    bool delta;
+    bool success = true;
+
+    LSErrorInit(&error);
+
+    delta = subscriber && subscriber->seq > 0 && !subscriber->resync;
+
+    reply_obj = jobject_create();
+
+    put_status_fields(reply_obj, fields, delta);
+
+    if (subscriber) {
+        jobject_put(reply_obj, J_CSTR_TO_JVAL("seq"), jnumber_create_i32(++subscriber->seq));
+        jobject_put(reply_obj, J_CSTR_TO_JVAL("delta"), jboolean_create(delta));
+        if (subscriber->seq == 1)
+            jobject_put(reply_obj, J_CSTR_TO_JVAL("subscribed"), jboolean_create(true));
+    }
+
+    jobject_put(reply_obj, J_CSTR_TO_JVAL("returnValue"), jboolean_create(true));
+
+    if (!LSMessageReply(handle, message, jvalue_tostring_simple(reply_obj), &error)) {
+        LSErrorPrint(&error, stderr);
+        LSErrorFree(&error);
+        success = false;
+    }
+
+    if (subscriber)
+        subscriber->resync = !success;
+
+    j_release(&reply_obj);
+
+    return success;
+}
+
+void AudioService::post_filtered_status(unsigned int changed)
+{
+    LSSubscriptionIter *iter = NULL;
+    LSError error;
+
+    if (g_hash_table_size(status_subscribers) == 0)
+        return;
+
+    LSErrorInit(&error);
+
+    if (!LSSubscriptionAcquire(handle, FILTERED_STATUS_KEY, &iter, &error)) {
+        LSErrorPrint(&error, stderr);
+        LSErrorFree(&error);
+        return;
+    }
+
+    status_generation++;
+
+    while (LSSubscriptionHasNext(iter)) {
+        LSMessage *message = LSSubscriptionNext(iter);
+        struct status_subscriber *subscriber;
+        unsigned int fields;
+
+        subscriber = static_cast<struct status_subscriber*>(
+            g_hash_table_lookup(status_subscribers, LSMessageGetUniqueToken(message)));
+        if (!subscriber)
+            continue;
+
+        subscriber->generation = status_generation;
+
+        fields = subscriber->resync ? subscriber->fields : changed & subscriber->fields;
+        if (fields)
+            send_status_fields(handle, message, fields, subscriber);
+    }
+
+    LSSubscriptionRelease(iter);
+
+    /* whoever didn't show up has cancelled */
+    g_hash_table_foreach_remove(status_subscribers, [] (gpointer key, gpointer value, gpointer user_data) -> gboolean {
+        struct status_subscriber *subscriber = static_cast<struct status_subscriber*>(value);
+        return subscriber->generation != *static_cast<unsigned int*>(user_data);
+    }, &status_generation);
+}
+
+/* Posts right away when things are calm. Within the window after that,
+ * further changes only leave a note and subscribers get the state as it is
+ * at the end of the window. */
+void AudioService::notify_status_subscribers()
+{
+    if (notify_timeout) {
+        notify_pending = true;
+        return;
+    }
+
+    post_status();
+
+    if (notify_window == 0)
+        return;
+
+    notify_timeout = g_timeout_add(notify_window, [] (gpointer user_data) -> gboolean {
+        AudioService *service = static_cast<AudioService*>(user_data);
+
+        if (!service->notify_pending) {
+            service->notify_timeout = 0;
+            return FALSE;
+        }
+
+        /* the next window starts with this post */
+        service->notify_pending = false;
+        service->post_status();
+
+        return TRUE;
+    }, this);
+}
+
+void AudioService::post_status()
+{
+    StatusKey key;
+    unsigned int changed;
+
+    g_message("Sending audio status update to subscribers");
+
+    published_volume = reported_volume();
+
+    luna_service_post_subscription_payload(handle, "/", "getStatus", get_status_payload(false));
+
+    fill_status_key(&key);
+    changed = status_key_diff(&posted_key, &key);
+    posted_key = key;
+
+    post_filtered_status(changed);
+
+    save_state();
+}
+
+void AudioService::notify_role_subscribers(struct role_volume_data *data)
+{
+    jvalue_ref reply_obj = NULL;
+
+    reply_obj = jobject_create();
+
+    jobject_put(reply_obj, J_CSTR_TO_JVAL("volume"),
+                jnumber_create_i32(volume_to_percent(mRoleVolumes->volume(data->role))));
+    jobject_put(reply_obj, J_CSTR_TO_JVAL("returnValue"), jboolean_create(true));
+
+    luna_service_post_subscription(handle, role_categories[data->role], "getVolume", reply_obj);
+    luna_service_post_subscription(palmHandle, role_categories[data->role], "getVolume", reply_obj);
+
+    j_release(&reply_obj);
+
+    save_state();
+}
+
+void AudioService::restore_state()
+{
+    unsigned int n;
+
+    volume = volume_to_percent(mState->get_integer("Volume", "Master", volume_from_percent(volume)));
+    mute = mState->get_boolean("Volume", "Mute", mute);
+    volume_balance = CLAMP(mState->get_double("Volume", "Balance", volume_balance), -1.0, 1.0);
+    volume_fade = CLAMP(mState->get_double("Volume", "Fade", volume_fade), -1.0, 1.0);
+
+    for (n = 0; n < VOLUME_ROLE_COUNT; n++) {
+        int role_volume = mState->get_integer("RoleVolume", volume_role_name((VolumeRole) n), PA_VOLUME_NORM);
+        mRoleVolumes->set_volume((VolumeRole) n, (pa_volume_t) CLAMP(role_volume, 0, (int) PA_VOLUME_NORM));
+    }
+
+    /* no call survives a reboot */
+    if (!mState->from_previous_boot()) {
+        in_call = mState->get_boolean("Call", "InCall", in_call);
+        speaker_mode = mState->get_boolean("Call", "SpeakerMode", speaker_mode);
+        mic_mute = mState->get_boolean("Call", "MicMute", mic_mute);
+    }
+
+    state_restored = true;
+}
+
+void AudioService::save_state()
+{
+    unsigned int n;
+
+    mState->set_integer("Volume", "Master", current_master_volume());
+    mState->set_boolean("Volume", "Mute", mute);
+    mState->set_double("Volume", "Balance", volume_balance);
+    mState->set_double("Volume", "Fade", volume_fade);
+
+    for (n = 0; n < VOLUME_ROLE_COUNT; n++)
+        mState->set_integer("RoleVolume", volume_role_name((VolumeRole) n),
+                            mRoleVolumes->volume((VolumeRole) n));
+
+    mState->set_boolean("Call", "InCall", in_call);
+    mState->set_boolean("Call", "SpeakerMode", speaker_mode);
+    mState->set_boolean("Call", "MicMute", mic_mute);
+
+    mState->save();
+}
+
+/* Puts the routing of a restored call back in place once connected. Volume
+ * and mute of the sink are whatever pulseaudio kept and get picked up like
+ * any other change of it. Nobody is waiting for a reply here. */
+void AudioService::reconcile_state()
+{
+    struct luna_service_req_data *req;
+
+    if (in_call || speaker_mode) {
+        g_message("Restoring call routing (inCall %d, speakerMode %d)", in_call, speaker_mode);
+
+        req = g_new0(struct luna_service_req_data, 1);
+        req->user_data = this;
+
+        apply_call_routing(req);
+    }
+
+    if (mic_mute) {
+        req = g_new0(struct luna_service_req_data, 1);
+        req->user_data = this;
+
+        apply_mic_mute(req);
+    }
+}
+
+pa_volume_t AudioService::volume_from_percent(int percent) const
+{
+    return mVolumeCurve->to_volume(percent);
+}
+
+int AudioService::volume_to_percent(pa_volume_t volume) const
+{
+    return mVolumeCurve->to_step(volume);
+}
+
+/* The volume everything new is relative to, which is what we end up with once
+ * all requests so far are applied */
+int AudioService::target_volume() const
+{
+    if (volume_ramp)
+        return volume_to_percent(volume_ramp->target());
+
+    if (volume_target_pending || volume_in_flight)
+        return volume_target;
+
+    return volume;
+}
+
+/* The master volume the sink has or is about to get, without any ramp */
+pa_volume_t AudioService::current_master_volume() const
+{
+    if (volume_target_pending || volume_in_flight)
+        return volume_target_raw;
+
+    if (sink_volume.channels > 0)
+        return pa_cvolume_max(&sink_volume);
+
+    return volume_from_percent(volume);
+}
+
+/* Scale the current channel volumes so the loudest one ends up at master,
+ * then put balance and fade back in case they got lost on the way down to
+ * silence */
+void AudioService::build_sink_volume(pa_volume_t master, pa_cvolume *cvolume) const
+{
+    if (sink_channel_map.channels == 0) {
+        pa_cvolume_set(cvolume, 1, master);
+        return;
+    }
+
+    if (pa_cvolume_compatible_with_channel_map(&sink_volume, &sink_channel_map)) {
+        *cvolume = sink_volume;
+        pa_cvolume_scale(cvolume, master);
+    }
+    else {
+        pa_cvolume_set(cvolume, sink_channel_map.channels, master);
+    }
+
+    if (pa_channel_map_can_balance(&sink_channel_map))
+        pa_cvolume_set_balance(cvolume, &sink_channel_map, volume_balance);
+
+    if (pa_channel_map_can_fade(&sink_channel_map))
+        pa_cvolume_set_fade(cvolume, &sink_channel_map, volume_fade);
+}
+
+void AudioService::put_status_fields(jvalue_ref obj, unsigned int fields, bool delta) const
+{
+    jvalue_ref channels_obj;
+    unsigned int n;
+
+    if (fields & STATUS_FIELD_VOLUME)
+        jobject_put(obj, J_CSTR_TO_JVAL("volume"), jnumber_create_f64(reported_volume()));
+
+    if (fields & STATUS_FIELD_BALANCE)
+        jobject_put(obj, J_CSTR_TO_JVAL("balance"), jnumber_create_i32((int) (volume_balance * 100.0f)));
+
+    if (fields & STATUS_FIELD_FADE)
+        jobject_put(obj, J_CSTR_TO_JVAL("fade"), jnumber_create_i32((int) (volume_fade * 100.0f)));
+
+    if ((fields & STATUS_FIELD_CHANNELS) &&
+        pa_cvolume_compatible_with_channel_map(&sink_volume, &sink_channel_map)) {
+        channels_obj = jarray_create(NULL);
+
+        for (n = 0; n < sink_volume.channels; n++) {
+            jvalue_ref channel_obj = jobject_create();
+
+            jobject_put(channel_obj, J_CSTR_TO_JVAL("position"),
+                        jstring_create(pa_channel_position_to_string(sink_channel_map.map[n])));
+            jobject_put(channel_obj, J_CSTR_TO_JVAL("volume"),
+                        jnumber_create_i32(volume_to_percent(sink_volume.values[n])));
+
+            jarray_append(channels_obj, channel_obj);
+        }
+
+        jobject_put(obj, J_CSTR_TO_JVAL("channels"), channels_obj);
+    }
+
+    if (fields & STATUS_FIELD_MUTE)
+        jobject_put(obj, J_CSTR_TO_JVAL("mute"), jboolean_create(mute));
+
+    if (fields & STATUS_FIELD_IN_CALL)
+        jobject_put(obj, J_CSTR_TO_JVAL("inCall"), jboolean_create(in_call));
+
+    if (fields & STATUS_FIELD_SPEAKER_MODE)
+        jobject_put(obj, J_CSTR_TO_JVAL("speakerMode"), jboolean_create(speaker_mode));
+
+    if (fields & STATUS_FIELD_MIC_MUTE)
+        jobject_put(obj, J_CSTR_TO_JVAL("micMute"), jboolean_create(mic_mute));
+
+    /* a delta has to tell that the ramp is over */
+    if (fields & STATUS_FIELD_RAMP_TARGET) {
+        if (volume_ramp)
+            jobject_put(obj, J_CSTR_TO_JVAL("rampTarget"), jnumber_create_i32(volume_to_percent(volume_ramp->target())));
+        else if (delta)
+            jobject_put(obj, J_CSTR_TO_JVAL("rampTarget"), jnull());
+    }
+}
+
+/* What clients get to see as the volume, the one promised to them when
+ * replying optimistically */
+int AudioService::reported_volume() const
+{
+    if (volume_optimistic && !volume_ramp)
+        return target_volume();
+
+    return volume;
+}
+
+void AudioService::set_volume(int volume, struct luna_service_req_data *req)
+{
+    /* explicit changes win over a ramp still going on */
+    cancel_volume_ramp();
+
+    queue_volume(volume_from_percent(volume), req);
+}
+
+void AudioService::queue_volume(pa_volume_t volume, struct luna_service_req_data *req)
+{
+    bool announce = false;
+
+    if (req && volume_optimistic) {
+        luna_service_message_reply_success(req->handle, req->message);
+        luna_service_req_data_free(req);
+        announce = true;
+    }
+    else if (req) {
+        g_queue_push_tail(&volume_waiters, req);
+    }
+
+    volume_target_raw = volume;
+    volume_target = volume_to_percent(volume);
+    volume_target_pending = true;
+
+    if (announce)
+        notify_status_subscribers();
+
+    /* only a single operation at a time, the one in flight picks up the new
+     * target once it's done */
+    if (!volume_in_flight)
+        apply_volume();
+}
+
+void AudioService::apply_volume()
+{
+    pa_operation *op;
+
+    new_volume = volume_target;
+    volume_target_pending = false;
+
+    build_sink_volume(volume_target_raw, &new_sink_volume);
+
+    op = pa_context_set_sink_volume_by_name(mContext, default_sink_name(), &new_sink_volume,
+                                            [] (pa_context *context, int success, void *user_data) {
+        AudioService *service = static_cast<AudioService*>(user_data);
+
+        service->volume_in_flight = false;
+
+        if (success) {
+            service->volume = service->new_volume;
+            service->sink_volume = service->new_sink_volume;
+        }
+
+        /* skip everything requested in between and go straight to the
+         * latest target */
+        if (service->volume_target_pending) {
+            service->apply_volume();
+            return;
+        }
+
+        service->finish_volume_requests(success);
+
+    }, this);
+
+    if (!op) {
+        finish_volume_requests(false);
+        return;
+    }
+
+    volume_in_flight = true;
+    pa_operation_unref(op);
+}
+
+void AudioService::finish_volume_requests(bool success)
+{
+    struct luna_service_req_data *req;
+
+    /* subscribers only hear about the start and the end of a ramp. With
+     * optimistic replies they already know the volume and only hear again
+     * when it didn't turn out as announced. */
+    if (!volume_ramp) {
+        if (volume_optimistic ? published_volume != volume : success)
+            notify_status_subscribers();
+    }
+
+    while ((req = (struct luna_service_req_data*) g_queue_pop_head(&volume_waiters)) != NULL) {
+        if (success)
+            luna_service_message_reply_success(req->handle, req->message);
+        else
+            luna_service_message_reply_custom_error(req->handle, req->message, "Could not set volume of default sink");
+
+        luna_service_req_data_free(req);
+    }
+}
+
+void AudioService::cancel_volume_ramp()
+{
+    if (!volume_ramp)
+        return;
+
+    g_message("Volume ramp to %d interrupted", volume_to_percent(volume_ramp->target()));
+
+    delete volume_ramp;
+    volume_ramp = 0;
+
+    if (volume_ramp_req) {
+        luna_service_message_reply_custom_error(volume_ramp_req->handle, volume_ramp_req->message,
+                                                "Volume ramp interrupted");
+        luna_service_req_data_free(volume_ramp_req);
+        volume_ramp_req = 0;
+    }
+}
+
+bool AudioService::volume_ramp_cb(LSHandle *handle, LSMessage *message, void *user_data)
+{
+    AudioService *service = static_cast<AudioService*>(user_data);
+    const char *payload;
+    jvalue_ref parsed_obj = NULL;
+    jvalue_ref value_obj = NULL;
+    raw_buffer curve_name;
+    VolumeRampCurve curve = VOLUME_RAMP_CURVE_LINEAR;
+    int target = 0, duration = 0;
+
+    if (!service->context_initialized) {
+        luna_service_message_reply_custom_error(handle, message, "Not yet initialized");
+        return true;
+    }
+
+    payload = LSMessageGetPayload(message);
+    parsed_obj = luna_service_message_parse_and_validate(payload);
+    if (jis_null(parsed_obj)) {
+        luna_service_message_reply_error_bad_json(handle, message);
+        goto cleanup;
+    }
+
+    if (!jobject_get_exists(parsed_obj, J_CSTR_TO_BUF("volume"), &value_obj) ||
+        !jis_number(value_obj)) {
+        luna_service_message_reply_error_bad_json(handle, message);
+        goto cleanup;
+    }
+
+    jnumber_get_i32(value_obj, &target);
+
+    if (target < 0 || target > 100) {
+        luna_service_message_reply_custom_error(handle, message, "Volume out of range. Must be in [0;100]");
+        goto cleanup;
+    }
+
+    if (!jobject_get_exists(parsed_obj, J_CSTR_TO_BUF("duration"), &value_obj) ||
+        !jis_number(value_obj)) {
+        luna_service_message_reply_error_bad_json(handle, message);
+        goto cleanup;
+    }
+
+    jnumber_get_i32(value_obj, &duration);
+
+    if (duration < 0 || duration > MAX_RAMP_DURATION) {
+        luna_service_message_reply_custom_error(handle, message, "Duration out of range. Must be in [0;"
+                                                G_STRINGIFY(MAX_RAMP_DURATION) "]");
+        goto cleanup;
+    }
+
+    curve_name = luna_service_message_get_string_buffer(parsed_obj, "curve");
+    if (curve_name.m_str && !volume_ramp_curve_parse(curve_name.m_str, curve_name.m_len, &curve)) {
+        luna_service_message_reply_custom_error(handle, message,
+            "Invalid parameters: curve must be one of linear, db or scurve");
+        goto cleanup;
+    }
+
+    /* a new ramp starts from wherever the current one got to */
+    service->cancel_volume_ramp();
+
+    service->volume_ramp_req = luna_service_req_data_new(handle, message);
+    service->volume_ramp = new VolumeRamp(service->current_master_volume(), service->volume_from_percent(target), duration, curve,
+                                          [service](pa_volume_t volume, bool last) {
+        struct luna_service_req_data *req;
+
+        if (!last) {
+            service->queue_volume(volume, NULL);
+            return;
+        }
+
+        /* the ramp is over once its final value is applied, which tells the
+         * caller and the subscribers */
+        req = service->volume_ramp_req;
+        service->volume_ramp_req = 0;
+
+        /* we are still running within the ramp, it goes once we returned */
+        g_idle_add([] (gpointer user_data) -> gboolean {
+            delete static_cast<VolumeRamp*>(user_data);
+            return FALSE;
+        }, service->volume_ramp);
+        service->volume_ramp = 0;
+
+        service->queue_volume(volume, req);
+    });
+
+    g_message("Ramping volume to %d within %dms", target, duration);
+
+    service->notify_status_subscribers();
+
+    service->volume_ramp->start();
 
-error:
-    if (handle != NULL) {
-        LSUnregister(handle, &error);
-        LSErrorFree(&error);
-    }
+cleanup:
+    if (!jis_null(parsed_obj))
+        j_release(&parsed_obj);
+
+    return true;
 }
 
-AudioService::~AudioService()
+bool AudioService::get_role_volume_cb(LSHandle *handle, LSMessage *message, void *user_data)
 {
-    LSError error;
+    struct role_volume_data *data = static_cast<struct role_volume_data*>(user_data);
+    jvalue_ref reply_obj = NULL;
+    bool subscribed = false;
 
-    LSErrorInit(&error);
+    subscribed = luna_service_check_for_subscription_and_process(handle, message);
 
-    if (handle != NULL && !LSUnregister(handle, &error)) {
-        g_warning("Could not unregister service: %s", error.message);
-        LSErrorFree(&error);
-    }
+    reply_obj = jobject_create();
 
-    g_free(mDefaultSinkName);
+    jobject_put(reply_obj, J_CSTR_TO_JVAL("volume"),
+                jnumber_create_i32(data->service->volume_to_percent(data->service->mRoleVolumes->volume(data->role))));
 
-    if (mContext)
-        pa_context_unref(mContext);
+    if (subscribed)
+        jobject_put(reply_obj, J_CSTR_TO_JVAL("subscribed"), jboolean_create(true));
+
+    jobject_put(reply_obj, J_CSTR_TO_JVAL("returnValue"), jboolean_create(true));
+
+    luna_service_message_validate_and_send(handle, message, reply_obj);
+
+    j_release(&reply_obj);
+
+    return true;
 }
 
-bool AudioService::play_feedback_cb(LSHandle *handle, LSMessage *message, void *user_data)
+bool AudioService::set_role_volume_cb(LSHandle *handle, LSMessage *message, void *user_data)
 {
-    AudioService *service = static_cast<AudioService*>(user_data);
+    struct role_volume_data *data = static_cast<struct role_volume_data*>(user_data);
+    AudioService *service = data->service;
     const char *payload;
-    jvalue_ref parsed_obj;
-    char *name, *sink;
-    bool play;
-    FeedbackEffect *effect = 0;
-
-    if (!service->context_initialized) {
-        luna_service_message_reply_custom_error(handle, message, "Not yet initialized");
-        return true;
-    }
+    jvalue_ref parsed_obj = NULL;
+    jvalue_ref volume_obj = NULL;
+    int new_volume = 0;
 
     payload = LSMessageGetPayload(message);
     parsed_obj = luna_service_message_parse_and_validate(payload);
@@ -207,27 +1404,28 @@ bool AudioService::play_feedback_cb(LSHandle *handle, LSMessage *message, void *
         goto cleanup;
     }
 
-    name = luna_service_message_get_string(parsed_obj, "name", NULL);
-    if (!name) {
-        luna_service_message_reply_custom_error(handle, message, "Invalid parameters: name parameter is required");
+    if (!jobject_get_exists(parsed_obj, J_CSTR_TO_BUF("volume"), &volume_obj) ||
+        !jis_number(volume_obj)) {
+        luna_service_message_reply_error_bad_json(handle, message);
         goto cleanup;
     }
 
-    play = luna_service_message_get_boolean(parsed_obj, "play", true);
-    sink = luna_service_message_get_string(parsed_obj, "sink", NULL);
+    jnumber_get_i32(volume_obj, &new_volume);
 
-    effect = new FeedbackEffect(service, name, std::string(sink ? sink : ""), play);
+    if (new_volume < 0 || new_volume > 100) {
+        luna_service_message_reply_custom_error(handle, message, "Volume out of range. Must be in [0;100]");
+        goto cleanup;
+    }
 
-    LSMessageRef(message);
+    g_message("Setting %s volume to %d", volume_role_name(data->role), new_volume);
 
-    effect->run([service, message](bool success) {
-        if (success)
-            luna_service_message_reply_success(message);
-        else
-            luna_service_message_reply_error_internal(message);
+    /* streams which are not there yet get it once they appear, so there is
+     * nothing to wait for */
+    service->mRoleVolumes->set_volume(data->role, service->volume_from_percent(new_volume));
 
-        LSMessageUnref(message);
-    });
+    luna_service_message_reply_success(handle, message);
+
+    service->notify_role_subscribers(data);
 
 cleanup:
     if (!jis_null(parsed_obj))
@@ -236,91 +1434,103 @@ cleanup:
     return true;
 }
 
-bool AudioService::get_status_cb(LSHandle *handle, LSMessage *message, void *user_data)
+bool AudioService::get_volume_balance_cb(LSHandle *handle, LSMessage *message, void *user_data)
 {
     AudioService *service = static_cast<AudioService*>(user_data);
     jvalue_ref reply_obj = NULL;
-    bool subscribed = false;
 
     if (!service->context_initialized) {
         luna_service_message_reply_custom_error(handle, message, "Not yet initialized");
         return true;
     }
 
-    subscribed = luna_service_check_for_subscription_and_process(handle, message);
-
     reply_obj = jobject_create();
 
-    jobject_put(reply_obj, J_CSTR_TO_JVAL("volume"), jnumber_create_f64(service->volume));
-    jobject_put(reply_obj, J_CSTR_TO_JVAL("mute"), jboolean_create(service->mute));
-    jobject_put(reply_obj, J_CSTR_TO_JVAL("inCall"), jboolean_create(service->in_call));
-    jobject_put(reply_obj, J_CSTR_TO_JVAL("speakerMode"), jboolean_create(service->speaker_mode));
-    jobject_put(reply_obj, J_CSTR_TO_JVAL("micMute"), jboolean_create(service->mic_mute));
-
-    if (subscribed)
-        jobject_put(reply_obj, J_CSTR_TO_JVAL("subscribed"), jboolean_create(true));
-
+    service->put_status_fields(reply_obj, STATUS_FIELD_BALANCE | STATUS_FIELD_FADE | STATUS_FIELD_CHANNELS, false);
     jobject_put(reply_obj, J_CSTR_TO_JVAL("returnValue"), jboolean_create(true));
 
-    if (!luna_service_message_validate_and_send(handle, message, reply_obj))
-        goto cleanup;
+    luna_service_message_validate_and_send(handle, message, reply_obj);
 
-cleanup:
-    if (!jis_null(reply_obj))
-        j_release(&reply_obj);
+    j_release(&reply_obj);
 
     return true;
 }
 
-void AudioService::notify_status_subscribers()
+bool AudioService::set_volume_balance_cb(LSHandle *handle, LSMessage *message, void *user_data)
 {
-    g_message("Sending audio status update to subscribers");
-
-    jvalue_ref reply_obj = NULL;
-
-    reply_obj = jobject_create();
+    AudioService *service = static_cast<AudioService*>(user_data);
+    const char *payload;
+    jvalue_ref parsed_obj = NULL;
+    jvalue_ref balance_obj = NULL;
+    jvalue_ref fade_obj = NULL;
+    struct luna_service_req_data *req;
+    int balance = 0, fade = 0;
 
-    jobject_put(reply_obj, J_CSTR_TO_JVAL("volume"), jnumber_create_f64(volume));
-    jobject_put(reply_obj, J_CSTR_TO_JVAL("mute"), jboolean_create(mute));
-    jobject_put(reply_obj, J_CSTR_TO_JVAL("returnValue"), jboolean_create(true));
+    if (!service->context_initialized) {
+        luna_service_message_reply_custom_error(handle, message, "Not yet initialized");
+        return true;
+    }
 
-    luna_service_post_subscription(handle, "/", "getStatus", reply_obj);
+    payload = LSMessageGetPayload(message);
+    parsed_obj = luna_service_message_parse_and_validate(payload);
+    if (jis_null(parsed_obj)) {
+        luna_service_message_reply_error_bad_json(handle, message);
+        goto cleanup;
+    }
 
-    j_release(&reply_obj);
-}
+    if (jobject_get_exists(parsed_obj, J_CSTR_TO_BUF("balance"), &balance_obj) && !jis_number(balance_obj))
+        balance_obj = NULL;
+    if (jobject_get_exists(parsed_obj, J_CSTR_TO_BUF("fade"), &fade_obj) && !jis_number(fade_obj))
+        fade_obj = NULL;
 
-void AudioService::set_volume(int volume, void *user_data)
-{
-    pa_cvolume cvolume;
-    pa_operation *op;
+    if (!balance_obj && !fade_obj) {
+        luna_service_message_reply_error_bad_json(handle, message);
+        goto cleanup;
+    }
 
-    new_volume = volume;
+    if (balance_obj) {
+        jnumber_get_i32(balance_obj, &balance);
 
-    pa_cvolume_set(&cvolume, 1, (new_volume * (double) (PA_VOLUME_NORM / 100)));
+        if (balance < -100 || balance > 100) {
+            luna_service_message_reply_custom_error(handle, message, "Balance out of range. Must be in [-100;100]");
+            goto cleanup;
+        }
 
-    op = pa_context_set_sink_volume_by_name(mContext, mDefaultSinkName, &cvolume,
-                                            [] (pa_context *context, int success, void *user_data) {
+        if (balance != 0 && !pa_channel_map_can_balance(&service->sink_channel_map)) {
+            luna_service_message_reply_custom_error(handle, message, "Default sink has no left and right channels");
+            goto cleanup;
+        }
+    }
 
-        struct luna_service_req_data *req = (struct luna_service_req_data*) user_data;
-        AudioService *service = static_cast<AudioService*>(req->user_data);
+    if (fade_obj) {
+        jnumber_get_i32(fade_obj, &fade);
 
-        if (!success) {
-            luna_service_message_reply_custom_error(req->handle, req->message, "Could not mute/unmute default sink");
+        if (fade < -100 || fade > 100) {
+            luna_service_message_reply_custom_error(handle, message, "Fade out of range. Must be in [-100;100]");
             goto cleanup;
         }
 
-        service->volume = service->new_volume;
-        service->volume_locked = false;
+        if (fade != 0 && !pa_channel_map_can_fade(&service->sink_channel_map)) {
+            luna_service_message_reply_custom_error(handle, message, "Default sink has no front and rear channels");
+            goto cleanup;
+        }
+    }
 
-        service->notify_status_subscribers();
+    if (balance_obj)
+        service->volume_balance = balance / 100.0f;
+    if (fade_obj)
+        service->volume_fade = fade / 100.0f;
 
-        luna_service_message_reply_success(req->handle, req->message);
+    /* goes through the same queue as the master volume, which picks up the
+     * new balance when applied; a running ramp keeps going from there */
+    req = luna_service_req_data_new(handle, message);
+    service->queue_volume(service->current_master_volume(), req);
 
-    cleanup:
-        luna_service_req_data_free(req);
+cleanup:
+    if (!jis_null(parsed_obj))
+        j_release(&parsed_obj);
 
-    }, user_data);
-    pa_operation_unref(op);
+    return true;
 }
 
 bool AudioService::volume_up_cb(LSHandle *handle, LSMessage *message, void *user_data)
@@ -334,12 +1544,7 @@ bool AudioService::volume_up_cb(LSHandle *handle, LSMessage *message, void *user
         return true;
     }
 
-    if (service->volume_locked) {
-        luna_service_message_reply_custom_error(handle, message, "Volume operation already pending");
-        return true;
-    }
-
-    normalized_volume = (service->volume / VOLUME_STEP) * VOLUME_STEP;
+    normalized_volume = (service->target_volume() / VOLUME_STEP) * VOLUME_STEP;
     if (normalized_volume >= 99)
         goto done;
     else if (normalized_volume >= 88) /* because VOLUME_STEP is 11, this adjustment is needed to get from 88 to 100 */
@@ -349,9 +1554,6 @@ bool AudioService::volume_up_cb(LSHandle *handle, LSMessage *message, void *user
     req = luna_service_req_data_new(handle, message);
     req->user_data = service;
 
-    service->volume_locked = true;
-    service->new_volume = normalized_volume + VOLUME_STEP;
-
     service->set_volume(normalized_volume + VOLUME_STEP, req);
 
     return true;
@@ -373,12 +1575,7 @@ bool AudioService::volume_down_cb(LSHandle *handle, LSMessage *message, void *us
         return true;
     }
 
-    if (service->volume_locked) {
-        luna_service_message_reply_custom_error(handle, message, "Volume operation already pending");
-        return true;
-    }
-
-    normalized_volume = ((service->volume + VOLUME_STEP - 1) / VOLUME_STEP) * VOLUME_STEP;
+    normalized_volume = ((service->target_volume() + VOLUME_STEP - 1) / VOLUME_STEP) * VOLUME_STEP;
     if (normalized_volume >= 100) /* If service->volume is 100, we'd be at 110. Adjust */
         normalized_volume = 99;
     else if (normalized_volume == 0)
@@ -387,10 +1584,7 @@ bool AudioService::volume_down_cb(LSHandle *handle, LSMessage *message, void *us
     req = luna_service_req_data_new(handle, message);
     req->user_data = service;
 
-    service->volume_locked = true;
-    service->new_volume = normalized_volume - VOLUME_STEP;
-
-    service->set_volume(service->new_volume, req);
+    service->set_volume(normalized_volume - VOLUME_STEP, req);
 
     return true;
 
@@ -414,11 +1608,6 @@ bool AudioService::set_volume_cb(LSHandle *handle, LSMessage *message, void *use
         return true;
     }
 
-    if (service->volume_locked) {
-        luna_service_message_reply_custom_error(handle, message, "Volume operation already pending");
-        return true;
-    }
-
     payload = LSMessageGetPayload(message);
     parsed_obj = luna_service_message_parse_and_validate(payload);
     if (jis_null(parsed_obj)) {
@@ -439,7 +1628,7 @@ bool AudioService::set_volume_cb(LSHandle *handle, LSMessage *message, void *use
         goto cleanup;
     }
 
-    if (new_volume == service->volume) {
+    if (new_volume == service->volume && !service->volume_target_pending && !service->volume_in_flight) {
         luna_service_message_reply_custom_error(handle, message,
             "Provided volume doesn't differ from current one");
         goto cleanup;
@@ -448,10 +1637,7 @@ bool AudioService::set_volume_cb(LSHandle *handle, LSMessage *message, void *use
     req = luna_service_req_data_new(handle, message);
     req->user_data = service;
 
-    service->volume_locked = true;
-    service->new_volume = new_volume;
-
-    service->set_volume(service->new_volume, req);
+    service->set_volume(new_volume, req);
 
 cleanup:
     if (!jis_null(parsed_obj))
@@ -490,7 +1676,7 @@ bool AudioService::set_mute_cb(LSHandle *handle, LSMessage *message, void *user_
     req = luna_service_req_data_new(handle, message);
     req->user_data = service;
 
-    op = pa_context_set_sink_mute_by_name(service->mContext, service->mDefaultSinkName, service->new_mute,
+    op = pa_context_set_sink_mute_by_name(service->mContext, service->default_sink_name(), service->new_mute,
                                           [](pa_context *context, int success, void *user_data) {
 
         struct luna_service_req_data *req = (struct luna_service_req_data*) user_data;
@@ -526,7 +1712,9 @@ void AudioService::finish_set_call_mode(bool success, void *user_data)
 {
     struct luna_service_req_data *req = (struct luna_service_req_data*) user_data;
 
-    if (success)
+    if (!req->message)
+        g_message("Restoring call routing %s", success ? "succeeded" : "failed");
+    else if (success)
         luna_service_message_reply_success(req->handle, req->message);
     else
         luna_service_message_reply_error_internal(req->handle, req->message);
@@ -534,199 +1722,200 @@ void AudioService::finish_set_call_mode(bool success, void *user_data)
     luna_service_req_data_free(req);
 }
 
-void AudioService::cm_source_port_set_cb(pa_context *context, int success, void *user_data)
+/* Profiles for calls differ between devices, the one of dual-sim devices is
+ * preferred */
+static const PulseCardProfile* find_voice_call_profile(const PulseCard *card)
 {
-    struct luna_service_req_data *req = (struct luna_service_req_data*) user_data;
-    AudioService *service = static_cast<AudioService*>(req->user_data);
+    const PulseCardProfile *voice_call = NULL;
+
+    for (const PulseCardProfile &profile : card->profiles) {
+        if (!strcasecmp(profile.name.c_str(), "voicecall-voicemmode1"))
+            return &profile;
+        if (!voice_call && (!strcasecmp(profile.name.c_str(), "voicecall") ||
+                            !strcasecmp(profile.name.c_str(), "voice call")))
+            voice_call = &profile;
+    }
 
-    service->finish_set_call_mode(true, user_data);
+    return voice_call;
 }
 
-void AudioService::cm_sourceinfo_cb(pa_context *context, const pa_source_info *info, int is_last, void *user_data)
+/* The source of the builtin mic, which is also the one of wired headsets */
+static const PulseSource* find_mic_source(PulseMirror *mirror)
 {
-    struct luna_service_req_data *req = (struct luna_service_req_data*) user_data;
-    AudioService *service = static_cast<AudioService*>(req->user_data);
-    pa_source_port_info *builtin_mic = NULL, *headset = NULL;
-    pa_source_port_info *preferred = NULL;
-    const char *name_to_set = NULL;
-    const char *value_to_set = NULL;
-    unsigned int i;
+    GHashTableIter iter;
+    gpointer value;
+
+    g_hash_table_iter_init(&iter, mirror->sources());
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        const PulseSource *source = static_cast<const PulseSource*>(value);
+
+        if (source->monitor_of_sink == PA_INVALID_INDEX && source->port("input-builtin_mic"))
+            return source;
+    }
+
+    return NULL;
+}
+
+void AudioService::apply_call_routing(struct luna_service_req_data *req)
+{
+    GHashTableIter iter;
+    gpointer value;
+    const PulseCard *card = NULL;
+    const PulseCardProfile *voice_call = NULL, *highest = NULL;
+    const char *profile = NULL;
     pa_operation *op;
-    static bool needreply = true;
 
-    if (is_last) {
-        if (needreply)
-            service->finish_set_call_mode(false, user_data);
-        needreply = true;
+    /* right after connecting there may be nothing to look at yet */
+    if (!mMirror->populated()) {
+        mMirror->when_settled([this, req] () { apply_call_routing(req); });
         return;
     }
 
-    if (info->monitor_of_sink != PA_INVALID_INDEX)
-        return;  /* Not the right source */
+    g_hash_table_iter_init(&iter, mMirror->cards());
+    while (!voice_call && g_hash_table_iter_next(&iter, NULL, &value)) {
+        card = static_cast<const PulseCard*>(value);
+        voice_call = find_voice_call_profile(card);
+    }
 
-    for (i = 0; i < info->n_ports; i++) {
-        if (!strcmp(info->ports[i]->name, "input-builtin_mic"))
-            builtin_mic = info->ports[i];
-        if (!strcmp(info->ports[i]->name, "input-wired_headset") &&
-                info->ports[i]->available != PA_PORT_AVAILABLE_NO)
-            headset = info->ports[i];
+    if (!voice_call) {
+        g_warning("No card with a voice call profile");
+        finish_set_call_mode(false, req);
+        return;
     }
 
-    if (!builtin_mic)
-        return; /* Not the right source */
+    for (const PulseCardProfile &card_profile : card->profiles) {
+        if (!highest || card_profile.priority > highest->priority)
+            highest = &card_profile;
+    }
 
-    preferred = headset ? headset : builtin_mic;
+    if (in_call && card->active_profile != voice_call->name)
+        profile = voice_call->name.c_str();
+    else if (!in_call && card->active_profile == voice_call->name)
+        profile = highest->name.c_str();
 
-    if (preferred && preferred != info->active_port) {
-        name_to_set = info->name;
-        value_to_set = preferred->name;
+    if (!profile) {
+        route_call_sink(req);
+        return;
     }
 
-    if (!!info->mute != !!service->mic_mute)
-        name_to_set = info->name;
+    op = pa_context_set_card_profile_by_name(mContext, card->name.c_str(), profile,
+                                             [] (pa_context *context, int success, void *user_data) {
+        struct luna_service_req_data *req = (struct luna_service_req_data*) user_data;
+        AudioService *service = static_cast<AudioService*>(req->user_data);
+
+        /* the sinks and sources of the new profile are announced only now,
+         * route once the mirror has them */
+        service->mMirror->when_settled([service, req] () { service->route_call_sink(req); });
+    }, req);
 
-    if (name_to_set) {
-        op = pa_context_set_source_port_by_name(service->mContext, name_to_set, value_to_set, cm_source_port_set_cb, req);
-        pa_operation_unref(op);
-    }
-    else {
-        service->finish_set_call_mode(false, req);
+    if (!op) {
+        finish_set_call_mode(false, req);
+        return;
     }
-    needreply = false;
-}
 
-void AudioService::cm_sink_port_set_cb(pa_context *context, int success, void *user_data)
-{
-    pa_operation *op;
-    op = pa_context_get_source_info_list(context, cm_sourceinfo_cb, user_data);
     pa_operation_unref(op);
 }
 
-void AudioService::cm_sinkinfo_cb(pa_context *context, const pa_sink_info *info, int is_last, void *user_data)
+void AudioService::route_call_sink(struct luna_service_req_data *req)
 {
-    struct luna_service_req_data *req = (struct luna_service_req_data*) user_data;
-    AudioService *service = static_cast<AudioService*>(req->user_data);
-    pa_sink_port_info *earpiece = NULL, *speaker = NULL, *headphones = NULL;
-    pa_sink_port_info *highest = NULL, *preferred = NULL;
+    GHashTableIter iter;
+    gpointer value;
+    const PulseSink *sink = NULL;
+    const PulsePort *earpiece = NULL, *speaker = NULL, *headphones = NULL;
+    const PulsePort *highest = NULL, *preferred = NULL;
     pa_operation *op;
-    unsigned int i;
-    static bool needreply = true;
 
-    if (is_last) {
-        if (needreply)
-            service->finish_set_call_mode(false, user_data);
-        needreply = true;
+    g_hash_table_iter_init(&iter, mMirror->sinks());
+    while (!earpiece && g_hash_table_iter_next(&iter, NULL, &value)) {
+        sink = static_cast<const PulseSink*>(value);
+        earpiece = sink->port("output-earpiece");
+    }
+
+    if (!earpiece) {
+        g_warning("No sink with an earpiece");
+        finish_set_call_mode(false, req);
         return;
     }
-    
-    // a reply is already being sent. Don't send another.
-    if(!needreply) return;
 
-    for (i = 0; i < info->n_ports; i++) {
-        if (!highest || info->ports[i]->priority > highest->priority) {
-            if (info->ports[i]->available != PA_PORT_AVAILABLE_NO)
-                highest = info->ports[i];
-        }
-        if (!strcmp(info->ports[i]->name, "output-earpiece"))
-            earpiece = info->ports[i];
-        if (!strcmp(info->ports[i]->name, "output-speaker"))
-            speaker = info->ports[i];
-        if (!strcmp(info->ports[i]->name, "output-wired_headset") &&
-                info->ports[i]->available != PA_PORT_AVAILABLE_NO)
-            headphones = info->ports[i];
-        if (!strcmp(info->ports[i]->name, "output-wired_headphone") &&
-                info->ports[i]->available != PA_PORT_AVAILABLE_NO)
-            headphones = info->ports[i];
+    for (const PulsePort &port : sink->ports) {
+        if (!port.available)
+            continue;
+
+        if (!highest || port.priority > highest->priority)
+            highest = &port;
+        if (port.name == "output-wired_headset" || port.name == "output-wired_headphone")
+            headphones = &port;
     }
 
-    if (!earpiece)
-        return; /* Not the right sink */
+    speaker = sink->port("output-speaker");
 
     /* TODO: When on ringtone and headphones are plugged in, people want output
        through *both* headphones and speaker, but when on call with speaker mode,
        people want *just* speaker, not including headphones. */
-    if (service->speaker_mode)
+    if (speaker_mode)
         preferred = speaker;
-    else if (service->in_call)
+    else if (in_call)
         preferred = headphones ? headphones : earpiece;
 
     if (!preferred)
         preferred = highest;
 
-    if (preferred && preferred != info->active_port) {
-        op = pa_context_set_sink_port_by_name(service->mContext, info->name, preferred->name, cm_sink_port_set_cb, req);
-        pa_operation_unref(op);
+    if (!preferred || preferred->name == sink->active_port) {
+        route_call_source(req);
+        return;
     }
-    else {
-        op = pa_context_get_source_info_list(context, cm_sourceinfo_cb, user_data);
-        pa_operation_unref(op);
+
+    op = pa_context_set_sink_port_by_name(mContext, sink->name.c_str(), preferred->name.c_str(),
+                                          [] (pa_context *context, int success, void *user_data) {
+        struct luna_service_req_data *req = (struct luna_service_req_data*) user_data;
+        AudioService *service = static_cast<AudioService*>(req->user_data);
+
+        service->route_call_source(req);
+    }, req);
+
+    if (!op) {
+        finish_set_call_mode(false, req);
+        return;
     }
-    needreply = false;
-}
 
-void AudioService::cm_card_profile_set_cb(pa_context *context, int success, void *user_data)
-{
-    pa_operation *op;
-    op = pa_context_get_sink_info_list(context, cm_sinkinfo_cb, user_data);
     pa_operation_unref(op);
 }
 
-void AudioService::cm_cardinfo_cb(pa_context *context, const pa_card_info *info, int is_last, void *user_data)
+void AudioService::route_call_source(struct luna_service_req_data *req)
 {
-    struct luna_service_req_data *req = (struct luna_service_req_data*) user_data;
-    AudioService *service = static_cast<AudioService*>(req->user_data);
-    pa_card_profile_info *voice_call = NULL, *highest = NULL;
-    const char *name_to_set = NULL;
-    const char *value_to_set = NULL;
+    const PulseSource *source;
+    const PulsePort *headset, *preferred;
     pa_operation *op;
-    unsigned int i;
-    static bool needreply = true;
 
-    if (is_last) {
-        if (needreply)
-            service->finish_set_call_mode(false, user_data);
-        needreply = true;
+    source = find_mic_source(mMirror);
+    if (!source) {
+        g_warning("No source with a builtin mic");
+        finish_set_call_mode(false, req);
         return;
     }
-    
-    // a reply is already being sent. Don't send another.
-    if(!needreply) return;
 
-    for (i = 0; i < info->n_profiles; i++) {
-        if (!highest || info->profiles[i].priority > highest->priority)
-            highest = &info->profiles[i];
-        if (!strcasecmp(info->profiles[i].name, "voicecall-voicemmode1")) {
-            // dual-sim device: take this voicecall profile in priority
-            voice_call = &info->profiles[i];
-        }
-        else if (NULL == voice_call && (!strcasecmp(info->profiles[i].name, "voicecall") || !strcasecmp(info->profiles[i].name, "voice call"))) {
-            // simple sim: both names are posible
-            voice_call = &info->profiles[i];
-        }
+    headset = source->port("input-wired_headset");
+    preferred = headset && headset->available ? headset : source->port("input-builtin_mic");
+
+    if (preferred->name == source->active_port) {
+        finish_set_call_mode(true, req);
+        return;
     }
 
-    if (!voice_call)
-        return; /* Not the right card */
+    op = pa_context_set_source_port_by_name(mContext, source->name.c_str(), preferred->name.c_str(),
+                                            [] (pa_context *context, int success, void *user_data) {
+        struct luna_service_req_data *req = (struct luna_service_req_data*) user_data;
+        AudioService *service = static_cast<AudioService*>(req->user_data);
 
-    if (service->in_call && (voice_call != info->active_profile)) {
-        name_to_set = info->name;
-        value_to_set = voice_call->name;
-    }
-    else if (!service->in_call && (voice_call == info->active_profile)) {
-        name_to_set = info->name;
-        value_to_set = highest->name;
-    }
+        service->finish_set_call_mode(success, req);
+    }, req);
 
-    if (name_to_set) {
-        op = pa_context_set_card_profile_by_name(service->mContext, name_to_set, value_to_set,
-                                            cm_card_profile_set_cb, req);
-        pa_operation_unref(op);
-    }
-    else {
-        op = pa_context_get_sink_info_list(context, cm_sinkinfo_cb, user_data);
-        pa_operation_unref(op);
+    if (!op) {
+        finish_set_call_mode(false, req);
+        return;
     }
-    needreply = false;
+
+    pa_operation_unref(op);
 }
 
 bool AudioService::set_call_mode_cb(LSHandle *handle, LSMessage *message, void *user_data)
@@ -735,7 +1924,6 @@ bool AudioService::set_call_mode_cb(LSHandle *handle, LSMessage *message, void *
     const char *payload;
     jvalue_ref parsed_obj = NULL;
     struct luna_service_req_data *req;
-    pa_operation *op;
 
     if (!service->context_initialized) {
         luna_service_message_reply_custom_error(handle, message, "Not yet initialized");
@@ -751,12 +1939,13 @@ bool AudioService::set_call_mode_cb(LSHandle *handle, LSMessage *message, void *
 
     service->in_call = luna_service_message_get_boolean(parsed_obj, "inCall", service->in_call);
     service->speaker_mode = luna_service_message_get_boolean(parsed_obj, "speakerMode", service->speaker_mode);
+    service->save_state();
+    service->notify_status_subscribers();
 
     req = luna_service_req_data_new(handle, message);
     req->user_data = service;
 
-    op = pa_context_get_card_info_list(service->mContext, cm_cardinfo_cb, req);
-    pa_operation_unref(op);
+    service->apply_call_routing(req);
 
 cleanup:
     if (!jis_null(parsed_obj))
@@ -765,78 +1954,56 @@ cleanup:
     return true;
 }
 
-void AudioService::finish_set_mic_mute(bool success, void *user_data)
-{
-    struct luna_service_req_data *req = (struct luna_service_req_data*) user_data;
-
-    if (success)
-        luna_service_message_reply_success(req->handle, req->message);
-    else
-        luna_service_message_reply_error_internal(req->handle, req->message);
-
-    luna_service_req_data_free(req);
-}
-
-void AudioService::mm_set_source_mute_cb(pa_context *context, int success, void *user_data)
-{
-    struct luna_service_req_data *req = (struct luna_service_req_data*) user_data;
-    AudioService *service = static_cast<AudioService*>(req->user_data);
-
-    service->finish_set_mic_mute(true, user_data);
-}
-
-void AudioService::mm_sourceinfo_cb(pa_context *context, const pa_source_info *info, int is_last, void *user_data)
+void AudioService::apply_mic_mute(struct luna_service_req_data *req)
 {
-    struct luna_service_req_data *req = (struct luna_service_req_data*) user_data;
-    AudioService *service = static_cast<AudioService*>(req->user_data);
-    pa_source_port_info *builtin_mic = NULL, *headset = NULL;
-    pa_source_port_info *preferred = NULL;
-    const char *name_to_set = NULL;
-    unsigned int i;
+    const PulseSource *source;
     pa_operation *op;
-    static bool needreply = true;
 
-    if (is_last) {
-        if (needreply)
-            service->finish_set_mic_mute(false, user_data);
-        needreply = true;
+    if (!mMirror->populated()) {
+        mMirror->when_settled([this, req] () { apply_mic_mute(req); });
         return;
     }
-    
-    // a reply is already being sent. Don't send another.
-    if(!needreply) return;
 
-    if (info->monitor_of_sink != PA_INVALID_INDEX)
-        return;  /* Not the right source */
+    source = find_mic_source(mMirror);
+    if (!source) {
+        g_warning("No source with a builtin mic");
+        finish_set_mic_mute(false, req);
+        return;
+    }
 
-    for (i = 0; i < info->n_ports; i++) {
-        if (!strcmp(info->ports[i]->name, "input-builtin_mic"))
-            builtin_mic = info->ports[i];
-        if (!strcmp(info->ports[i]->name, "input-wired_headset") &&
-                info->ports[i]->available != PA_PORT_AVAILABLE_NO)
-            headset = info->ports[i];
+    if (source->mute == mic_mute) {
+        finish_set_mic_mute(true, req);
+        return;
     }
 
-    if (!builtin_mic)
-        return; /* Not the right source */
+    op = pa_context_set_source_mute_by_name(mContext, source->name.c_str(), mic_mute,
+                                            [] (pa_context *context, int success, void *user_data) {
+        struct luna_service_req_data *req = (struct luna_service_req_data*) user_data;
+        AudioService *service = static_cast<AudioService*>(req->user_data);
+
+        service->finish_set_mic_mute(success, req);
+    }, req);
+
+    if (!op) {
+        finish_set_mic_mute(false, req);
+        return;
+    }
 
-    preferred = headset ? headset : builtin_mic;
+    pa_operation_unref(op);
+}
 
-    if (preferred && preferred != info->active_port)
-        name_to_set = info->name;
+void AudioService::finish_set_mic_mute(bool success, void *user_data)
+{
+    struct luna_service_req_data *req = (struct luna_service_req_data*) user_data;
 
-    if (!!info->mute != !!service->mic_mute)
-        name_to_set = info->name;
+    if (!req->message)
+        g_message("Restoring mic mute %s", success ? "succeeded" : "failed");
+    else if (success)
+        luna_service_message_reply_success(req->handle, req->message);
+    else
+        luna_service_message_reply_error_internal(req->handle, req->message);
 
-    if (name_to_set) {
-        op = pa_context_set_source_mute_by_name(service->mContext, name_to_set, service->mic_mute,
-                                                mm_set_source_mute_cb, req);
-        pa_operation_unref(op);
-    }
-    else {
-        service->finish_set_mic_mute(false, req);
-    }
-    needreply = false;
+    luna_service_req_data_free(req);
 }
 
 bool AudioService::set_mic_mute_cb(LSHandle *handle, LSMessage *message, void *user_data)
@@ -845,7 +2012,6 @@ bool AudioService::set_mic_mute_cb(LSHandle *handle, LSMessage *message, void *u
     const char *payload;
     jvalue_ref parsed_obj = NULL;
     struct luna_service_req_data *req;
-    pa_operation *op;
 
     if (!service->context_initialized) {
         luna_service_message_reply_custom_error(handle, message, "Not yet initialized");
@@ -860,12 +2026,13 @@ bool AudioService::set_mic_mute_cb(LSHandle *handle, LSMessage *message, void *u
     }
 
     service->mic_mute = luna_service_message_get_boolean(parsed_obj, "micMute", service->mic_mute);
+    service->save_state();
+    service->notify_status_subscribers();
 
     req = luna_service_req_data_new(handle, message);
     req->user_data = service;
 
-    op = pa_context_get_source_info_list(service->mContext, mm_sourceinfo_cb, req);
-    pa_operation_unref(op);
+    service->apply_mic_mute(req);
 
 cleanup:
     if (!jis_null(parsed_obj))
@@ -874,53 +2041,56 @@ cleanup:
     return true;
 }
 
-void AudioService::default_sink_info_cb(pa_context *context, const pa_sink_info *info, int eol, void *user_data)
-{
-    AudioService *service = static_cast<AudioService*>(user_data);
-
-    if (info == NULL)
-        return;
-
-    if (service->mute != info->mute)
-        service->mute = info->mute;
-
-    int current_volume = (info->volume.values[0] / (PA_VOLUME_NORM / 100));
-    if (service->volume != current_volume)
-        service->volume = current_volume;
-
-    service->default_sink_index = info->index;
-}
-
-void AudioService::server_info_cb(pa_context *context, const pa_server_info *info, void *user_data)
+void AudioService::default_sink_changed(const PulseSink *sink)
 {
-    AudioService *service = static_cast<AudioService*>(user_data);
+    StatusKey key;
+    int current_volume;
+
+    if (mute != sink->mute)
+        mute = sink->mute;
+
+    sink_channel_map = sink->channel_map;
+
+    /* while one of our own changes is on its way this may still be the old
+     * volume, the change itself tells us the new one */
+    if (!volume_in_flight) {
+        sink_volume = sink->volume;
+
+        /* someone else may have changed the balance, but there is nothing to
+         * learn from a silent sink */
+        if (pa_cvolume_max(&sink->volume) > PA_VOLUME_MUTED) {
+            if (pa_channel_map_can_balance(&sink->channel_map))
+                volume_balance = pa_cvolume_get_balance(&sink->volume, &sink->channel_map);
+            if (pa_channel_map_can_fade(&sink->channel_map))
+                volume_fade = pa_cvolume_get_fade(&sink->volume, &sink->channel_map);
+        }
+    }
 
-    if (info == NULL)
-        return;
+    current_volume = volume_to_percent(pa_cvolume_max(&sink->volume));
+    if (volume != current_volume)
+        volume = current_volume;
 
-    g_free(service->mDefaultSinkName);
-    service->mDefaultSinkName = g_strdup(info->default_sink_name);
+    /* Changed by someone else or not what we announced, but our own changes
+     * still on their way correct that themselves. Posting saves the state. */
+    fill_status_key(&key);
+    if (published_volume >= 0 && !volume_in_flight && !volume_ramp &&
+        status_key_diff(&posted_key, &key) != 0)
+        notify_status_subscribers();
+    else
+        save_state();
 
-    pa_context_get_sink_info_by_name(service->mContext, info->default_sink_name, &AudioService::default_sink_info_cb, service);
-}
+    default_sink_index = sink->index;
 
-void AudioService::update_properties()
-{
-    pa_context_get_server_info(mContext, server_info_cb, this);
+    mSampleCache->set_target_format(&sink->sample_spec, &sink->channel_map);
+    mFeedbackStream->open(sink->name.c_str(), &sink->sample_spec, &sink->channel_map);
 }
 
 void AudioService::context_subscribe_cb(pa_context *context, pa_subscription_event_type_t type, uint32_t idx, void *user_data)
 {
     AudioService *service = static_cast<AudioService*>(user_data);
 
-    if ((type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) == PA_SUBSCRIPTION_EVENT_CARD &&
-        (type & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_CHANGE) {
-        /* listen for card plug/unplug events */
-        /* FIXME */
-    }
-    else if ((type & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_SINK) {
-        service->update_properties();
-    }
+    /* the mirror tells us about what we care about once it has the object */
+    service->mMirror->event(type, idx);
 }
 
 void AudioService::context_state_cb(pa_context *context, void *user_data)
@@ -949,8 +2119,22 @@ void AudioService::context_state_cb(pa_context *context, void *user_data)
 
         if (service->context_initialized) {
             pa_context_set_subscribe_callback(service->mContext, context_subscribe_cb, service);
-            pa_context_subscribe(service->mContext, PA_SUBSCRIPTION_MASK_CARD, NULL, service);
-            service->update_properties();
+            pa_context_subscribe(service->mContext, (pa_subscription_mask_t)
+                                 (PA_SUBSCRIPTION_MASK_SINK | PA_SUBSCRIPTION_MASK_SOURCE |
+                                  PA_SUBSCRIPTION_MASK_SINK_INPUT | PA_SUBSCRIPTION_MASK_SOURCE_OUTPUT |
+                                  PA_SUBSCRIPTION_MASK_CARD | PA_SUBSCRIPTION_MASK_SERVER),
+                                 NULL, service);
+            service->mMirror->populate();
+
+            if (service->state_restored)
+                service->reconcile_state();
+
+            /* pick up what a previous instance of us left in the sample
+             * cache of pulseaudio and upload all other system sounds in the
+             * background so the first feedback played doesn't have to wait
+             * for its upload */
+            service->mSampleCache->adopt_resident_samples();
+            service->mSampleCache->prewarm();
         }
     }
 }
@@ -19,9 +19,27 @@
 #ifndef AUDIO_SERVICE_H_
 #define AUDIO_SERVICE_H_
 
+#include <glib.h>
 #include <luna-service2/lunaservice.h>
 #include <pulse/pulseaudio.h>
 #include <pulse/glib-mainloop.h>
+#include <pbnjson.h>
+
+class SampleCache;
+class FeedbackStream;
+class FeedbackEffectPool;
+class FeedbackScheduler;
+class Settings;
+class VolumeRamp;
+class RoleVolumes;
+class VolumeCurve;
+class StateStore;
+class PulseMirror;
+struct PulseSink;
+
+struct luna_service_req_data;
+struct role_volume_data;
+struct status_subscriber;
 
 class AudioService
 {
@@ -30,7 +48,13 @@ public:
     ~AudioService();
 
     pa_context* context() const { return mContext; }
-    const char* default_sink_name() const { return mDefaultSinkName; }
+    const char* default_sink_name() const;
+    SampleCache* sample_cache() const { return mSampleCache; }
+    FeedbackStream* feedback_stream() const { return mFeedbackStream; }
+    FeedbackScheduler* feedback_scheduler() const { return mFeedbackScheduler; }
+    Settings* settings() const { return mSettings; }
+    RoleVolumes* role_volumes() const { return mRoleVolumes; }
+    PulseMirror* pulse_mirror() const { return mMirror; }
 
 private:
     LSHandle *handle;
@@ -42,34 +66,110 @@ private:
     int new_volume;
     int mute;
     int new_mute;
-    char *mDefaultSinkName;
     int default_sink_index;
     bool in_call;
     bool speaker_mode;
     bool mic_mute;
-    bool volume_locked;
+    /* The default sink's volume per channel. The master volume is its
+     * loudest channel, balance and fade describe how the others relate to
+     * it and are kept across master volume changes */
+    pa_channel_map sink_channel_map;
+    pa_cvolume sink_volume;
+    pa_cvolume new_sink_volume;
+    float volume_balance;
+    float volume_fade;
+    /* Volume requests arriving while one is applied collapse into the
+     * latest target, everyone waiting is answered once it is in place */
+    int volume_target;
+    pa_volume_t volume_target_raw;
+    bool volume_target_pending;
+    bool volume_in_flight;
+    GQueue volume_waiters;
+    /* With optimistic replies volume requests are answered and announced
+     * as soon as they are accepted, subscribers are corrected if the sink
+     * ends up somewhere else */
+    bool volume_optimistic;
+    int published_volume;
+    VolumeRamp *volume_ramp;
+    /* Everything the getStatus reply is made of. The reply is serialized
+     * again only once this changes. */
+    struct StatusKey {
+        int volume;
+        int mute;
+        bool in_call;
+        bool speaker_mode;
+        bool mic_mute;
+        float balance;
+        float fade;
+        pa_channel_map channel_map;
+        pa_cvolume channel_volume;
+        pa_volume_t ramp_target;
+    };
+    StatusKey status_key;
+    char *status_payload;
+    char *status_payload_subscribed;
+    unsigned int status_version;
+    /* subscribers asking for some fields only get deltas of what changed
+     * since the last post, keyed by the unique token of their message */
+    StatusKey posted_key;
+    GHashTable *status_subscribers;
+    unsigned int status_generation;
+    /* Pulseaudio events come in bursts, status updates go out at most once
+     * per window */
+    unsigned int notify_window;
+    guint notify_timeout;
+    bool notify_pending;
+    struct luna_service_req_data *volume_ramp_req;
+    SampleCache *mSampleCache;
+    FeedbackStream *mFeedbackStream;
+    FeedbackEffectPool *mFeedbackEffects;
+    FeedbackScheduler *mFeedbackScheduler;
+    Settings *mSettings;
+    RoleVolumes *mRoleVolumes;
+    VolumeCurve *mVolumeCurve;
+    StateStore *mState;
+    PulseMirror *mMirror;
+    bool state_restored;
+    struct role_volume_data *mRoleData;
 
 private:
-    void update_properties();
+    void default_sink_changed(const PulseSink *sink);
+    void restore_state();
+    void save_state();
+    void reconcile_state();
+    void fill_status_key(StatusKey *key) const;
+    static unsigned int status_key_diff(const StatusKey *a, const StatusKey *b);
+    const char* get_status_payload(bool subscribed);
+    void put_status_fields(jvalue_ref obj, unsigned int fields, bool delta) const;
+    void subscribe_status(LSHandle *handle, LSMessage *message, unsigned int fields);
+    bool send_status_fields(LSHandle *handle, LSMessage *message, unsigned int fields,
+                            struct status_subscriber *subscriber);
+    void post_filtered_status(unsigned int changed);
     void notify_status_subscribers();
+    void post_status();
+    void notify_role_subscribers(struct role_volume_data *data);
+    void apply_mic_mute(struct luna_service_req_data *req);
     void finish_set_mic_mute(bool success, void *user_data);
+    void apply_call_routing(struct luna_service_req_data *req);
+    void route_call_sink(struct luna_service_req_data *req);
+    void route_call_source(struct luna_service_req_data *req);
     void finish_set_call_mode(bool success, void *user_data);
-    void set_volume(int volume, void *user_data);
+    pa_volume_t volume_from_percent(int percent) const;
+    int volume_to_percent(pa_volume_t volume) const;
+    int target_volume() const;
+    int reported_volume() const;
+    pa_volume_t current_master_volume() const;
+    void build_sink_volume(pa_volume_t master, pa_cvolume *cvolume) const;
+    void set_volume(int volume, struct luna_service_req_data *req);
+    void queue_volume(pa_volume_t volume, struct luna_service_req_data *req);
+    void apply_volume();
+    void cancel_volume_ramp();
+    void finish_volume_requests(bool success);
     bool preload_sample(struct play_feedback_data *pfd);
 
 private:
     static void context_state_cb(pa_context *mContext, void *user_data);
     static void context_subscribe_cb(pa_context *mContext, pa_subscription_event_type_t type, uint32_t idx, void *user_data);
-    static void server_info_cb(pa_context *mContext, const pa_server_info *info, void *user_data);
-    static void default_sink_info_cb(pa_context *mContext, const pa_sink_info *info, int eol, void *user_data);
-    static void mm_sourceinfo_cb(pa_context *mContext, const pa_source_info *info, int is_last, void *user_data);
-    static void mm_set_source_mute_cb(pa_context *mContext, int success, void *user_data);
-    static void cm_cardinfo_cb(pa_context *mContext, const pa_card_info *info, int is_last, void *user_data);
-    static void cm_card_profile_set_cb(pa_context *mContext, int success, void *user_data);
-    static void cm_sinkinfo_cb(pa_context *mContext, const pa_sink_info *info, int is_last, void *user_data);
-    static void cm_sink_port_set_cb(pa_context *mContext, int success, void *user_data);
-    static void cm_sourceinfo_cb(pa_context *mContext, const pa_source_info *info, int is_last, void *user_data);
-    static void cm_source_port_set_cb(pa_context *mContext, int success, void *user_data);
 
 public:
     static bool get_status_cb(LSHandle *handle, LSMessage *message, void *user_data);
@@ -77,9 +177,15 @@ public:
     static bool set_mic_mute_cb(LSHandle *handle, LSMessage *message, void *user_data);
     static bool set_mute_cb(LSHandle *handle, LSMessage *message, void *user_data);
     static bool set_volume_cb(LSHandle *handle, LSMessage *message, void *user_data);
+    static bool get_role_volume_cb(LSHandle *handle, LSMessage *message, void *user_data);
+    static bool set_role_volume_cb(LSHandle *handle, LSMessage *message, void *user_data);
+    static bool get_volume_balance_cb(LSHandle *handle, LSMessage *message, void *user_data);
+    static bool set_volume_balance_cb(LSHandle *handle, LSMessage *message, void *user_data);
     static bool volume_down_cb(LSHandle *handle, LSMessage *message, void *user_data);
+    static bool volume_ramp_cb(LSHandle *handle, LSMessage *message, void *user_data);
     static bool volume_up_cb(LSHandle *handle, LSMessage *message, void *user_data);
     static bool play_feedback_cb(LSHandle *handle, LSMessage *message, void *user_data);
+    static bool play_sequence_cb(LSHandle *handle, LSMessage *message, void *user_data);
 };
 
 #endif
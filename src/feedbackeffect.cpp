@@ -16,32 +16,64 @@
 *
 * LICENSE@@@ */
 
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/stat.h>
+#include <glib.h>
 
 #include "feedbackeffect.h"
 #include "audioservice.h"
+#include "samplecache.h"
+#include "feedbackstream.h"
+#include "feedbackscheduler.h"
+#include "rolevolumes.h"
+
+/* All effects share the same properties, we're running as event to enable
+ * ducking */
+static pa_proplist* event_proplist(void)
+{
+    static pa_proplist *proplist = NULL;
 
-#define SAMPLE_PATH		"/usr/share/systemsounds"
+    if (!proplist) {
+        proplist = pa_proplist_new();
+        pa_proplist_sets(proplist, PA_PROP_MEDIA_ROLE, "event");
+    }
 
-static GSList *sample_list = NULL;
+    return proplist;
+}
 
-FeedbackEffect::FeedbackEffect(AudioService *service, const std::string& name, const std::string& sink, bool play) :
+FeedbackEffect::FeedbackEffect(AudioService *service) :
     mService(service),
-    mName(name),
-    mSink(sink),
-    mPlay(play),
-    mSampleLength(0),
-    mStreamWritten(0)
+    mPlay(true),
+    mLowLatency(false),
+    mLatency(PA_USEC_INVALID),
+    mUserData(0),
+    mHasPriority(false),
+    mPriority(FEEDBACK_PRIORITY_NORMAL),
+    mVoice(0),
+    mNextFree(0)
 {
 }
 
 FeedbackEffect::~FeedbackEffect()
 {
-    if (mFd > 0)
-        close(mFd);
+}
+
+void FeedbackEffect::prepare(const char *name, size_t name_length, const char *sink, size_t sink_length,
+                             bool play, bool low_latency)
+{
+    /* assigning keeps the capacity of the strings from earlier requests */
+    mName.assign(name ? name : "", name ? name_length : 0);
+    mSink.assign(sink ? sink : "", sink ? sink_length : 0);
+    mPlay = play;
+    mLowLatency = low_latency;
+    mLatency = PA_USEC_INVALID;
+    mUserData = 0;
+    mHasPriority = false;
+    mVoice = 0;
+}
+
+void FeedbackEffect::set_priority(FeedbackPriority priority)
+{
+    mPriority = priority;
+    mHasPriority = true;
 }
 
 void FeedbackEffect::run(FeedbackEffectResultCallback callback)
@@ -53,6 +85,13 @@ void FeedbackEffect::run(FeedbackEffectResultCallback callback)
         return;
     }
 
+    /* bursts of the same sample are merged into a single play */
+    if (mPlay && !mService->sample_cache()->admit(mName)) {
+        g_debug("Coalescing play of sample %s", mName.c_str());
+        finish(true);
+        return;
+    }
+
     preload_sample();
 }
 
@@ -65,8 +104,10 @@ void FeedbackEffect::finish(bool success)
 void FeedbackEffect::play_sample()
 {
     pa_operation *op;
-    pa_proplist *proplist;
     const char *sink = 0;
+    Sample *sample;
+    FeedbackPriority priority;
+    pa_usec_t duration = 0;
 
     if (!mPlay) {
         finish(true);
@@ -83,113 +124,107 @@ void FeedbackEffect::play_sample()
         return;
     }
 
-    /* make sure we're running as event to enable ducking */
-    proplist = pa_proplist_new();
-    pa_proplist_setf(proplist, PA_PROP_MEDIA_ROLE, "event");
+    sample = mService->sample_cache()->lookup(mName);
 
-    g_message("Playing sample %s on sink %s", mName.c_str(), sink);
+    if (mLowLatency) {
+        if (mService->feedback_stream()->can_play(sample, sink)) {
+            g_debug("Playing sample %s on sink %s with low latency", mName.c_str(), sink);
 
-    op = pa_context_play_sample_with_proplist(mService->context(), mName.c_str(),
-                                              sink, PA_VOLUME_NORM, proplist,
-                                              [] (pa_context *c, uint32_t idx, void *user_data) {
-        FeedbackEffect *effect = static_cast<FeedbackEffect*>(user_data);
+            mService->sample_cache()->played(mName);
 
-        if (idx == PA_INVALID_INDEX) {
-            effect->finish(false);
+            mService->feedback_stream()->play(sample, [this](bool success, pa_usec_t latency) {
+                mLatency = latency;
+                finish(success);
+            });
             return;
         }
 
-        effect->finish(true);
-
-    }, this);
-
-    if (op)
-        pa_operation_unref(op);
-}
+        g_message("Low latency playback of sample %s not possible, falling back", mName.c_str());
+    }
 
-void FeedbackEffect::preload_sample()
-{
-    struct stat st;
-    pa_sample_spec spec;
-    char *sample_path;
+    priority = mHasPriority ? mPriority : (sample ? sample->priority : FEEDBACK_PRIORITY_NORMAL);
+    if (sample && pa_sample_spec_valid(&sample->spec))
+        duration = pa_bytes_to_usec(sample->length, &sample->spec);
 
-    if (g_slist_find_custom(sample_list, mName.c_str(),
-                            [](gconstpointer a, gconstpointer b) { return g_strcmp0((gchar*) a, (gchar*) b); })) {
-        g_message("Not preloading sample %s as it is already", mName.c_str());
-        play_sample();
+    /* too many sounds playing and none less important than this one */
+    if (!mService->feedback_scheduler()->admit(priority, duration, &mVoice)) {
+        finish(true);
         return;
     }
 
-    g_message("Preloading sample %s", mName.c_str());
+    g_debug("Playing sample %s on sink %s", mName.c_str(), sink);
 
-    sample_path = g_strdup_printf("%s/%s.pcm", SAMPLE_PATH, mName.c_str());
+    mService->sample_cache()->played(mName);
 
-    if (stat(sample_path, &st) != 0) {
-        g_warning("Sample %s doesn't exist", sample_path);
-        g_free(sample_path);
-        finish(false);
-        return;
-    }
+    op = pa_context_play_sample_with_proplist(mService->context(), mName.c_str(),
+                                              sink, mService->role_volumes()->apply(VOLUME_ROLE_SYSTEM,
+                                                        sample ? sample->volume : PA_VOLUME_NORM),
+                                              event_proplist(),
+                                              [] (pa_context *c, uint32_t idx, void *user_data) {
+        FeedbackEffect *effect = static_cast<FeedbackEffect*>(user_data);
 
-    mSampleLength = st.st_size;
+        if (idx == PA_INVALID_INDEX) {
+            effect->mService->feedback_scheduler()->failed(effect->mVoice);
+            effect->finish(false);
+            return;
+        }
 
-    spec.format = PA_SAMPLE_S16LE;
-    spec.rate = 44100;
-    spec.channels = 1;
+        effect->mService->feedback_scheduler()->started(effect->mVoice, idx);
+        effect->finish(true);
 
-    mFd = open(sample_path, O_RDONLY);
-    if (mFd < 0){
-        g_free(sample_path);
-        finish(false);
-        return;
-    }
+    }, this);
 
-    mSampleStream = pa_stream_new(mService->context(), mName.c_str(), &spec, NULL);
-    if (!mSampleStream){
-        g_free(sample_path);
+    if (!op) {
+        mService->feedback_scheduler()->failed(mVoice);
         finish(false);
         return;
     }
 
-    pa_stream_set_state_callback(mSampleStream, [](pa_stream *stream, void *user_data) {
-        FeedbackEffect *effect = static_cast<FeedbackEffect*>(user_data);
+    pa_operation_unref(op);
+}
 
-        switch (pa_stream_get_state(stream)) {
-        case PA_STREAM_CREATING:
-        case PA_STREAM_READY:
+void FeedbackEffect::preload_sample()
+{
+    mService->sample_cache()->load(mName, [this](bool success) {
+        if (!success) {
+            finish(false);
             return;
-        case PA_STREAM_TERMINATED:
-            g_message("Successfully uploaded sample %s to pulseaudio", effect->mName.c_str());
-            sample_list = g_slist_append(sample_list, g_strdup(effect->mName.c_str()));
-            effect->play_sample();
-            break;
-        case PA_STREAM_FAILED:
-        default:
-            g_warning("Failed to upload sample %s", effect->mName.c_str());
-            effect->finish(false);
-            break;
         }
-    }, this);
 
-    pa_stream_set_write_callback(mSampleStream, [](pa_stream *stream, size_t length, void *user_data) {
-        FeedbackEffect *effect = static_cast<FeedbackEffect*>(user_data);
-        void *buffer;
-        ssize_t bread;
+        play_sample();
+    });
+}
+
+FeedbackEffectPool::FeedbackEffectPool(AudioService *service) :
+    mService(service),
+    mFree(0)
+{
+}
 
-        buffer = pa_xmalloc(effect->mSampleLength);
+FeedbackEffectPool::~FeedbackEffectPool()
+{
+    while (mFree) {
+        FeedbackEffect *effect = mFree;
+        mFree = effect->mNextFree;
+        delete effect;
+    }
+}
 
-        bread = read(effect->mFd, buffer, effect->mSampleLength);
-        effect->mStreamWritten += bread;
+FeedbackEffect* FeedbackEffectPool::acquire()
+{
+    FeedbackEffect *effect = mFree;
 
-        pa_stream_write(stream, buffer, bread, pa_xfree, 0, PA_SEEK_RELATIVE);
+    if (!effect)
+        return new FeedbackEffect(mService);
 
-        if (effect->mStreamWritten == effect->mSampleLength) {
-            pa_stream_set_write_callback(stream, NULL, NULL);
-            pa_stream_finish_upload(stream);
-        }
-    }, this);
+    mFree = effect->mNextFree;
+    effect->mNextFree = 0;
 
-    pa_stream_connect_upload(mSampleStream, mSampleLength);
+    return effect;
+}
 
-    g_free(sample_path);
+void FeedbackEffectPool::release(FeedbackEffect *effect)
+{
+    effect->mNextFree = mFree;
+    mFree = effect;
 }
@@ -23,6 +23,8 @@
 #include <functional>
 #include <pulse/pulseaudio.h>
 
+#include "feedbackscheduler.h"
+
 typedef std::function<void(bool)> FeedbackEffectResultCallback;
 
 class AudioService;
@@ -30,26 +32,60 @@ class AudioService;
 class FeedbackEffect
 {
 public:
-    FeedbackEffect(AudioService *service, const std::string& name, const std::string& sink, bool play);
+    explicit FeedbackEffect(AudioService *service);
     ~FeedbackEffect();
 
+    void prepare(const char *name, size_t name_length, const char *sink, size_t sink_length,
+                 bool play, bool low_latency);
+    void set_priority(FeedbackPriority priority);
     void run(FeedbackEffectResultCallback callback);
 
+    /* start latency measured in low latency mode or PA_USEC_INVALID */
+    pa_usec_t latency() const { return mLatency; }
+
+    void set_user_data(void *user_data) { mUserData = user_data; }
+    void* user_data() const { return mUserData; }
+
 private:
+    friend class FeedbackEffectPool;
+
     AudioService *mService;
     std::string mName;
     std::string mSink;
     bool mPlay;
-    pa_stream *mSampleStream;
-    unsigned int mSampleLength;
-    unsigned int mStreamWritten;
-    int mFd;
+    bool mLowLatency;
+    pa_usec_t mLatency;
+    void *mUserData;
+
+    /* overrides the priority configured for the sample */
+    bool mHasPriority;
+    FeedbackPriority mPriority;
+    unsigned int mVoice;
 
     FeedbackEffectResultCallback mCallback;
 
+    /* next free effect while sitting in the pool */
+    FeedbackEffect *mNextFree;
+
     void preload_sample();
     void play_sample();
     void finish(bool success);
 };
 
+/* Effects are reused for further requests once they finished so playing
+ * feedback does not allocate anything once the pool warmed up. */
+class FeedbackEffectPool
+{
+public:
+    explicit FeedbackEffectPool(AudioService *service);
+    ~FeedbackEffectPool();
+
+    FeedbackEffect* acquire();
+    void release(FeedbackEffect *effect);
+
+private:
+    AudioService *mService;
+    FeedbackEffect *mFree;
+};
+
 #endif // FEEDBACKEFFECT_H
@@ -0,0 +1,176 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <string.h>
+
+#include "feedbackscheduler.h"
+#include "audioservice.h"
+#include "settings.h"
+
+static const char *priority_names[] = {
+    "low",
+    "normal",
+    "high",
+    "critical"
+};
+
+bool feedback_priority_parse(const char *value, size_t length, FeedbackPriority *priority)
+{
+    unsigned int n;
+
+    if (!value)
+        return false;
+
+    for (n = 0; n < G_N_ELEMENTS(priority_names); n++) {
+        if (strlen(priority_names[n]) == length && strncmp(priority_names[n], value, length) == 0) {
+            *priority = (FeedbackPriority) n;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+FeedbackScheduler::FeedbackScheduler(AudioService *service) :
+    mService(service),
+    mVoices(0),
+    mMaxVoices(0),
+    mNextId(1)
+{
+    mMaxVoices = MAX(service->settings()->get_integer("Feedback", "MaxStreams", 0), 0);
+
+    /* slots for all voices up front so scheduling never allocates */
+    if (mMaxVoices > 0) {
+        mVoices = g_new0(Voice, mMaxVoices);
+        g_message("Limiting feedback to %u sounds at the same time", mMaxVoices);
+    }
+}
+
+FeedbackScheduler::~FeedbackScheduler()
+{
+    g_free(mVoices);
+}
+
+FeedbackScheduler::Voice* FeedbackScheduler::find(unsigned int id)
+{
+    unsigned int n;
+
+    for (n = 0; n < mMaxVoices; n++) {
+        if (mVoices[n].id == id)
+            return &mVoices[n];
+    }
+
+    return NULL;
+}
+
+void FeedbackScheduler::kill(uint32_t index)
+{
+    pa_operation *op;
+
+    op = pa_context_kill_sink_input(mService->context(), index, NULL, NULL);
+    if (op)
+        pa_operation_unref(op);
+}
+
+bool FeedbackScheduler::admit(FeedbackPriority priority, pa_usec_t duration, unsigned int *voice)
+{
+    Voice *slot = NULL;
+    gint64 now;
+    unsigned int n;
+
+    *voice = 0;
+
+    if (mMaxVoices == 0)
+        return true;
+
+    now = g_get_monotonic_time();
+
+    /* pulseaudio doesn't tell us when a sample finished playing, so a voice
+     * is considered done once the duration of its sample has passed */
+    for (n = 0; n < mMaxVoices && !slot; n++) {
+        if (mVoices[n].id == 0 || mVoices[n].ends <= now)
+            slot = &mVoices[n];
+    }
+
+    if (!slot) {
+        /* the least important voice, and of those the one playing longest */
+        Voice *victim = &mVoices[0];
+
+        for (n = 1; n < mMaxVoices; n++) {
+            if (mVoices[n].priority < victim->priority ||
+                (mVoices[n].priority == victim->priority && mVoices[n].started < victim->started))
+                victim = &mVoices[n];
+        }
+
+        if (victim->priority >= priority) {
+            g_debug("All %u feedback voices busy, dropping sound", mMaxVoices);
+            return false;
+        }
+
+        /* a voice still waiting for its sink input is killed once it shows
+         * up in started() as it can't be found anymore */
+        if (victim->index != PA_INVALID_INDEX) {
+            g_debug("Preempting feedback sink input %u", victim->index);
+            kill(victim->index);
+        }
+
+        slot = victim;
+    }
+
+    slot->id = mNextId++;
+    if (mNextId == 0)
+        mNextId = 1;
+
+    slot->priority = priority;
+    slot->index = PA_INVALID_INDEX;
+    slot->started = now;
+    slot->ends = now + duration;
+
+    *voice = slot->id;
+
+    return true;
+}
+
+void FeedbackScheduler::started(unsigned int voice, uint32_t index)
+{
+    Voice *slot;
+
+    if (voice == 0)
+        return;
+
+    slot = find(voice);
+    if (!slot) {
+        /* preempted before it even started */
+        kill(index);
+        return;
+    }
+
+    slot->index = index;
+}
+
+void FeedbackScheduler::failed(unsigned int voice)
+{
+    Voice *slot;
+
+    if (voice == 0)
+        return;
+
+    slot = find(voice);
+    if (slot)
+        slot->id = 0;
+}
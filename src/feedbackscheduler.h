@@ -0,0 +1,72 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef FEEDBACKSCHEDULER_H
+#define FEEDBACKSCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <glib.h>
+#include <pulse/pulseaudio.h>
+
+enum FeedbackPriority {
+    FEEDBACK_PRIORITY_LOW,
+    FEEDBACK_PRIORITY_NORMAL,
+    FEEDBACK_PRIORITY_HIGH,
+    FEEDBACK_PRIORITY_CRITICAL
+};
+
+bool feedback_priority_parse(const char *value, size_t length, FeedbackPriority *priority);
+
+class AudioService;
+
+/* Keeps the number of feedback sounds playing at the same time below a limit.
+ * Once it is reached a new sound replaces the least important one playing if
+ * it is more important itself, otherwise it is dropped. */
+class FeedbackScheduler
+{
+public:
+    explicit FeedbackScheduler(AudioService *service);
+    ~FeedbackScheduler();
+
+    /* Returns false if the sound should not be played. Otherwise voice is the
+     * id to report the sink input or the failure of the play with, 0 if
+     * there is no limit and nothing needs to be reported. */
+    bool admit(FeedbackPriority priority, pa_usec_t duration, unsigned int *voice);
+    void started(unsigned int voice, uint32_t index);
+    void failed(unsigned int voice);
+
+private:
+    struct Voice {
+        unsigned int id;
+        FeedbackPriority priority;
+        uint32_t index;
+        gint64 started;
+        gint64 ends;
+    };
+
+    AudioService *mService;
+    Voice *mVoices;
+    unsigned int mMaxVoices;
+    unsigned int mNextId;
+
+    Voice* find(unsigned int id);
+    void kill(uint32_t index);
+};
+
+#endif // FEEDBACKSCHEDULER_H
@@ -0,0 +1,326 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "feedbacksequence.h"
+#include "audioservice.h"
+#include "samplecache.h"
+#include "rolevolumes.h"
+
+/* All samples of a sequence share one stream, so unlike single plays the
+ * gain normalizing their loudness is applied while copying them */
+static void apply_volume(void *buffer, size_t length, pa_sample_format_t format, pa_volume_t volume)
+{
+    float factor, value;
+    size_t n;
+
+    if (volume == PA_VOLUME_NORM)
+        return;
+
+    factor = (float) pa_sw_volume_to_linear(volume);
+
+    switch (format) {
+    case PA_SAMPLE_S16LE: {
+        gint16 *data = static_cast<gint16*>(buffer);
+
+        for (n = 0; n < length / sizeof(gint16); n++) {
+            value = GINT16_FROM_LE(data[n]) * factor;
+            data[n] = GINT16_TO_LE((gint16) CLAMP(value, -32768.0f, 32767.0f));
+        }
+        break;
+    }
+    case PA_SAMPLE_FLOAT32LE: {
+        guint32 *data = static_cast<guint32*>(buffer);
+        union {
+            guint32 u;
+            float f;
+        } converted;
+
+        for (n = 0; n < length / sizeof(guint32); n++) {
+            converted.u = GUINT32_FROM_LE(data[n]);
+            converted.f *= factor;
+            data[n] = GUINT32_TO_LE(converted.u);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+FeedbackSequence::FeedbackSequence(AudioService *service, const std::string& sink) :
+    mService(service),
+    mSink(sink),
+    mPendingLoads(0),
+    mLoadFailed(false),
+    mStream(0),
+    mCurrent(0),
+    mPosition(0)
+{
+    memset(&mSpec, 0, sizeof(mSpec));
+}
+
+FeedbackSequence::~FeedbackSequence()
+{
+    if (mStream) {
+        pa_stream_set_state_callback(mStream, NULL, NULL);
+        pa_stream_set_write_callback(mStream, NULL, NULL);
+        pa_stream_disconnect(mStream);
+        pa_stream_unref(mStream);
+    }
+
+    for (auto &item : mItems) {
+        if (item.sample)
+            mService->sample_cache()->release(item.sample);
+    }
+}
+
+void FeedbackSequence::add(const std::string& name, unsigned int gap)
+{
+    SequenceItem item;
+
+    item.name = name;
+    item.gap = gap;
+    item.sample = 0;
+
+    mItems.push_back(item);
+}
+
+void FeedbackSequence::run(FeedbackSequenceResultCallback callback)
+{
+    mCallback = callback;
+
+    if (mItems.empty()) {
+        finish(false);
+        return;
+    }
+
+    load_samples();
+}
+
+void FeedbackSequence::finish(bool success)
+{
+    if (mStream) {
+        pa_stream_set_state_callback(mStream, NULL, NULL);
+        pa_stream_set_write_callback(mStream, NULL, NULL);
+        pa_stream_disconnect(mStream);
+        pa_stream_unref(mStream);
+        mStream = 0;
+    }
+
+    /* the callback is allowed to delete us */
+    if (mCallback)
+        mCallback(this, success);
+}
+
+void FeedbackSequence::load_samples()
+{
+    size_t count = mItems.size();
+
+    /* load everything first so the stream never has to wait for an upload.
+     * The last load might finish us right away, don't touch any member after
+     * it was started. */
+    mPendingLoads = count;
+
+    for (size_t n = 0; n < count; n++) {
+        mService->sample_cache()->load(mItems[n].name, [this, n](bool success) {
+            SequenceItem &item = mItems[n];
+
+            if (success) {
+                item.sample = mService->sample_cache()->lookup(item.name);
+                mService->sample_cache()->hold(item.sample);
+            }
+            else {
+                g_warning("Failed to load sample %s of sequence", item.name.c_str());
+                mLoadFailed = true;
+            }
+
+            if (--mPendingLoads > 0)
+                return;
+
+            if (mLoadFailed) {
+                finish(false);
+                return;
+            }
+
+            start_stream();
+        });
+    }
+}
+
+void FeedbackSequence::start_stream()
+{
+    const char *sink;
+    pa_proplist *proplist;
+
+    mSpec = mItems[0].sample->spec;
+
+    /* all samples are written to the same stream so they need to agree on
+     * the format, which they do once converted to the format of the sink */
+    for (auto &item : mItems) {
+        if (!pa_sample_spec_equal(&item.sample->spec, &mSpec)) {
+            g_warning("Sample %s of sequence has a different format than %s",
+                      item.name.c_str(), mItems[0].name.c_str());
+            finish(false);
+            return;
+        }
+    }
+
+    for (auto &item : mItems)
+        mService->sample_cache()->played(item.name);
+
+    if (mSink.length() == 0)
+        sink = mService->default_sink_name();
+    else
+        sink = mSink.c_str();
+
+    proplist = pa_proplist_new();
+    pa_proplist_sets(proplist, PA_PROP_MEDIA_ROLE, "event");
+
+    mStream = pa_stream_new_with_proplist(mService->context(), "feedback sequence", &mSpec,
+                                          mService->sample_cache()->channel_map(mItems[0].sample),
+                                          proplist);
+    pa_proplist_free(proplist);
+
+    if (!mStream) {
+        finish(false);
+        return;
+    }
+
+    pa_stream_set_state_callback(mStream, stream_state_cb, this);
+    pa_stream_set_write_callback(mStream, stream_write_cb, this);
+
+    if (pa_stream_connect_playback(mStream, sink, NULL, (pa_stream_flags_t) 0, NULL, NULL) < 0) {
+        g_warning("Failed to connect stream for sequence: %s",
+                  pa_strerror(pa_context_errno(mService->context())));
+        finish(false);
+    }
+}
+
+size_t FeedbackSequence::gap_length(const SequenceItem& item) const
+{
+    /* already a multiple of the frame size */
+    return pa_usec_to_bytes((pa_usec_t) item.gap * PA_USEC_PER_MSEC, &mSpec);
+}
+
+void FeedbackSequence::write(size_t length)
+{
+    uint8_t silence;
+    void *buffer;
+    size_t chunk, gap;
+
+    switch (mSpec.format) {
+    case PA_SAMPLE_U8:
+        silence = 0x80;
+        break;
+    case PA_SAMPLE_ALAW:
+        silence = 0xd5;
+        break;
+    case PA_SAMPLE_ULAW:
+        silence = 0xff;
+        break;
+    default:
+        silence = 0;
+        break;
+    }
+
+    while (length > 0 && mCurrent < mItems.size()) {
+        const SequenceItem &item = mItems[mCurrent];
+        const Sample *sample = item.sample;
+
+        gap = gap_length(item);
+
+        if (mPosition < gap)
+            chunk = MIN(length, gap - mPosition);
+        else
+            chunk = MIN(length, gap + sample->length - mPosition);
+
+        if (pa_stream_begin_write(mStream, &buffer, &chunk) < 0 || !buffer) {
+            g_warning("Failed to get buffer for sequence");
+            finish(false);
+            return;
+        }
+
+        /* the buffer we got might be larger than what we asked for */
+        if (mPosition < gap) {
+            chunk = MIN(chunk, MIN(length, gap - mPosition));
+            memset(buffer, silence, chunk);
+        }
+        else {
+            chunk = MIN(chunk, MIN(length, gap + sample->length - mPosition));
+            memcpy(buffer, sample->data + sample->offset + (mPosition - gap), chunk);
+            apply_volume(buffer, chunk, mSpec.format,
+                         mService->role_volumes()->apply(VOLUME_ROLE_SYSTEM, sample->volume));
+        }
+
+        pa_stream_write(mStream, buffer, chunk, NULL, 0, PA_SEEK_RELATIVE);
+
+        mPosition += chunk;
+        length -= chunk;
+
+        if (mPosition == gap + sample->length) {
+            mCurrent++;
+            mPosition = 0;
+        }
+    }
+
+    if (mCurrent < mItems.size())
+        return;
+
+    /* everything is queued, reply once it was played */
+    pa_stream_set_write_callback(mStream, NULL, NULL);
+
+    pa_operation *op = pa_stream_drain(mStream, stream_drain_cb, this);
+    if (!op) {
+        finish(false);
+        return;
+    }
+
+    pa_operation_unref(op);
+}
+
+void FeedbackSequence::stream_state_cb(pa_stream *stream, void *user_data)
+{
+    FeedbackSequence *sequence = static_cast<FeedbackSequence*>(user_data);
+
+    switch (pa_stream_get_state(stream)) {
+    case PA_STREAM_FAILED:
+    case PA_STREAM_TERMINATED:
+        g_warning("Stream for sequence failed");
+        sequence->finish(false);
+        break;
+    default:
+        break;
+    }
+}
+
+void FeedbackSequence::stream_write_cb(pa_stream *stream, size_t length, void *user_data)
+{
+    FeedbackSequence *sequence = static_cast<FeedbackSequence*>(user_data);
+
+    sequence->write(length);
+}
+
+void FeedbackSequence::stream_drain_cb(pa_stream *stream, int success, void *user_data)
+{
+    FeedbackSequence *sequence = static_cast<FeedbackSequence*>(user_data);
+
+    sequence->finish(success != 0);
+}
@@ -0,0 +1,77 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef FEEDBACKSEQUENCE_H
+#define FEEDBACKSEQUENCE_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <pulse/pulseaudio.h>
+
+class AudioService;
+class FeedbackSequence;
+struct Sample;
+
+typedef std::function<void(FeedbackSequence*, bool)> FeedbackSequenceResultCallback;
+
+struct SequenceItem
+{
+    std::string name;
+    /* silence in milliseconds before the sample starts */
+    unsigned int gap;
+    Sample *sample;
+};
+
+/* Plays several samples with silence between them through a single
+ * playback stream so the spacing is exact to the sample. */
+class FeedbackSequence
+{
+public:
+    FeedbackSequence(AudioService *service, const std::string& sink);
+    ~FeedbackSequence();
+
+    void add(const std::string& name, unsigned int gap);
+    void run(FeedbackSequenceResultCallback callback);
+
+private:
+    AudioService *mService;
+    std::string mSink;
+    std::vector<SequenceItem> mItems;
+    unsigned int mPendingLoads;
+    bool mLoadFailed;
+
+    pa_stream *mStream;
+    pa_sample_spec mSpec;
+    size_t mCurrent;
+    size_t mPosition;
+
+    FeedbackSequenceResultCallback mCallback;
+
+    void load_samples();
+    void start_stream();
+    void write(size_t length);
+    size_t gap_length(const SequenceItem& item) const;
+    void finish(bool success);
+
+    static void stream_state_cb(pa_stream *stream, void *user_data);
+    static void stream_write_cb(pa_stream *stream, size_t length, void *user_data);
+    static void stream_drain_cb(pa_stream *stream, int success, void *user_data);
+};
+
+#endif // FEEDBACKSEQUENCE_H
@@ -0,0 +1,339 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "feedbackstream.h"
+#include "audioservice.h"
+#include "samplecache.h"
+#include "samplefile.h"
+#include "rolevolumes.h"
+#include "settings.h"
+
+/* Default amount of audio in milliseconds we keep buffered in the stream */
+#define DEFAULT_TARGET_LATENCY_MSEC	10
+/* Time in milliseconds after the last sample played out until we cork the
+ * stream again */
+#define IDLE_CORK_MSEC			2000
+/* Latency measurements we wait for at the same time, plays beyond that are
+ * reported without one */
+#define MAX_LATENCY_REQUESTS		8
+
+struct latency_request {
+    FeedbackStreamResultCallback callback;
+    pa_usec_t duration;
+    /* NULL while the slot is free */
+    pa_operation *op;
+};
+
+/* A source which only becomes ready at the time set with
+ * g_source_set_ready_time, so the idle timer is re-armed with every play
+ * instead of adding a new source each time */
+static gboolean idle_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    g_source_set_ready_time(source, -1);
+    callback(user_data);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs idle_source_funcs = {
+    NULL,
+    NULL,
+    idle_source_dispatch,
+    NULL
+};
+
+FeedbackStream::FeedbackStream(AudioService *service) :
+    mService(service),
+    mStream(0),
+    mTargetLatency(0),
+    mVolume(PA_VOLUME_INVALID),
+    mRequests(0),
+    mCorked(false),
+    mIdleSource(0)
+{
+    unsigned int n;
+    int latency;
+
+    latency = service->settings()->get_integer("Feedback", "LowLatencyTarget", DEFAULT_TARGET_LATENCY_MSEC);
+    if (latency > 0)
+        mTargetLatency = latency * PA_USEC_PER_MSEC;
+
+    memset(&mSpec, 0, sizeof(mSpec));
+    pa_channel_map_init(&mMap);
+
+    mRequests = new latency_request[MAX_LATENCY_REQUESTS];
+    for (n = 0; n < MAX_LATENCY_REQUESTS; n++) {
+        mRequests[n].duration = 0;
+        mRequests[n].op = NULL;
+    }
+
+    mIdleSource = g_source_new(&idle_source_funcs, sizeof(GSource));
+    g_source_set_callback(mIdleSource, idle_cb, this, NULL);
+    g_source_set_ready_time(mIdleSource, -1);
+    g_source_attach(mIdleSource, NULL);
+}
+
+FeedbackStream::~FeedbackStream()
+{
+    close();
+
+    g_source_destroy(mIdleSource);
+    g_source_unref(mIdleSource);
+    delete[] mRequests;
+}
+
+void FeedbackStream::open(const char *sink, const pa_sample_spec *spec, const pa_channel_map *map)
+{
+    pa_sample_spec stream_spec;
+    pa_buffer_attr attr;
+    pa_proplist *proplist;
+    pa_stream_flags_t flags;
+
+    if (mTargetLatency == 0 || !sink)
+        return;
+
+    /* write samples exactly in the format the sample cache converts them to */
+    sample_file_converted_spec(spec, &stream_spec);
+
+    if (mStream && mSink == sink && pa_sample_spec_equal(&mSpec, &stream_spec))
+        return;
+
+    close();
+
+    mSink = sink;
+    mVolume = PA_VOLUME_INVALID;
+    mSpec = stream_spec;
+    mMap = *map;
+
+    proplist = pa_proplist_new();
+    pa_proplist_sets(proplist, PA_PROP_MEDIA_ROLE, "event");
+    pa_proplist_sets(proplist, PA_PROP_MEDIA_NAME, "feedback");
+
+    mStream = pa_stream_new_with_proplist(mService->context(), "feedback", &mSpec,
+                                          mMap.channels == mSpec.channels ? &mMap : NULL,
+                                          proplist);
+    pa_proplist_free(proplist);
+
+    if (!mStream) {
+        g_warning("Failed to create low latency feedback stream");
+        return;
+    }
+
+    pa_stream_set_state_callback(mStream, stream_state_cb, this);
+
+    /* Keep only a few milliseconds buffered and start playing as soon as a
+     * single frame is available so a click starts right after it was written */
+    attr.maxlength = (uint32_t) -1;
+    attr.tlength = pa_usec_to_bytes(mTargetLatency, &mSpec);
+    attr.prebuf = pa_frame_size(&mSpec);
+    attr.minreq = (uint32_t) -1;
+    attr.fragsize = (uint32_t) -1;
+
+    /* an uncorked stream keeps the sink from suspending even while it has
+     * nothing to play, so it is uncorked only while feedback plays */
+    flags = (pa_stream_flags_t) (PA_STREAM_ADJUST_LATENCY |
+                                 PA_STREAM_AUTO_TIMING_UPDATE |
+                                 PA_STREAM_INTERPOLATE_TIMING |
+                                 PA_STREAM_START_CORKED);
+    mCorked = true;
+
+    if (pa_stream_connect_playback(mStream, mSink.c_str(), &attr, flags, NULL, NULL) < 0) {
+        g_warning("Failed to connect low latency feedback stream: %s",
+                  pa_strerror(pa_context_errno(mService->context())));
+        close();
+    }
+}
+
+void FeedbackStream::close()
+{
+    unsigned int n;
+
+    /* pending timing updates are cancelled with the stream, the samples were
+     * written nevertheless so finish them without a latency */
+    for (n = 0; n < MAX_LATENCY_REQUESTS; n++) {
+        struct latency_request *request = &mRequests[n];
+        FeedbackStreamResultCallback callback;
+
+        if (!request->op)
+            continue;
+
+        pa_operation_cancel(request->op);
+        pa_operation_unref(request->op);
+        request->op = NULL;
+
+        callback.swap(request->callback);
+        callback(true, PA_USEC_INVALID);
+    }
+
+    g_source_set_ready_time(mIdleSource, -1);
+
+    if (!mStream)
+        return;
+
+    pa_stream_set_state_callback(mStream, NULL, NULL);
+    pa_stream_disconnect(mStream);
+    pa_stream_unref(mStream);
+    mStream = 0;
+}
+
+void FeedbackStream::stream_state_cb(pa_stream *stream, void *user_data)
+{
+    FeedbackStream *feedback_stream = static_cast<FeedbackStream*>(user_data);
+
+    switch (pa_stream_get_state(stream)) {
+    case PA_STREAM_READY:
+        g_message("Low latency feedback stream ready on sink %s", feedback_stream->mSink.c_str());
+        break;
+    case PA_STREAM_FAILED:
+    case PA_STREAM_TERMINATED:
+        /* gets opened again with the next update of the default sink */
+        g_warning("Low latency feedback stream on sink %s closed", feedback_stream->mSink.c_str());
+        feedback_stream->close();
+        break;
+    default:
+        break;
+    }
+}
+
+void FeedbackStream::cork(bool corked)
+{
+    pa_operation *op;
+
+    if (mCorked == corked)
+        return;
+
+    op = pa_stream_cork(mStream, corked, NULL, NULL);
+    if (!op)
+        return;
+
+    pa_operation_unref(op);
+    mCorked = corked;
+}
+
+gboolean FeedbackStream::idle_cb(gpointer user_data)
+{
+    FeedbackStream *feedback_stream = static_cast<FeedbackStream*>(user_data);
+
+    if (feedback_stream->mStream)
+        feedback_stream->cork(true);
+
+    return FALSE;
+}
+
+bool FeedbackStream::can_play(const Sample *sample, const char *sink) const
+{
+    if (!mStream || pa_stream_get_state(mStream) != PA_STREAM_READY)
+        return false;
+
+    if (!sample || sample->state != SAMPLE_STATE_RESIDENT || !sample->data)
+        return false;
+
+    if (sink && mSink != sink)
+        return false;
+
+    return pa_sample_spec_equal(&sample->spec, &mSpec);
+}
+
+void FeedbackStream::play(const Sample *sample, FeedbackStreamResultCallback callback)
+{
+    struct latency_request *request = NULL;
+    pa_usec_t duration;
+    pa_volume_t sample_volume;
+    unsigned int n;
+    pa_cvolume volume;
+    pa_operation *op;
+
+    sample_volume = mService->role_volumes()->apply(VOLUME_ROLE_SYSTEM, sample->volume);
+
+    /* The gain normalizing the sample is applied as volume of the stream so
+     * writing it stays a plain copy. Commands on the connection are handled
+     * in order so the volume is in place before the data arrives. */
+    if (sample_volume != mVolume) {
+        pa_cvolume_set(&volume, mSpec.channels, sample_volume);
+
+        op = pa_context_set_sink_input_volume(mService->context(), pa_stream_get_index(mStream),
+                                              &volume, NULL, NULL);
+        if (op) {
+            pa_operation_unref(op);
+            mVolume = sample_volume;
+        }
+    }
+
+    /* like the volume the uncork is in place before the data arrives */
+    cork(false);
+
+    /* Replace whatever is still queued from a previous click so the new one
+     * starts right away instead of after the old one */
+    if (pa_stream_write(mStream, sample->data + sample->offset, sample->length,
+                        NULL, 0, PA_SEEK_RELATIVE_ON_READ) < 0) {
+        g_warning("Failed to write sample %s to low latency feedback stream", sample->name.c_str());
+        callback(false, 0);
+        return;
+    }
+
+    duration = pa_bytes_to_usec(sample->length, &mSpec);
+
+    /* a burst of clicks keeps the stream running, it is corked once the
+     * last of them played out */
+    g_source_set_ready_time(mIdleSource, g_get_monotonic_time() + duration + IDLE_CORK_MSEC * PA_USEC_PER_MSEC);
+
+    for (n = 0; n < MAX_LATENCY_REQUESTS && !request; n++) {
+        if (!mRequests[n].op)
+            request = &mRequests[n];
+    }
+
+    if (!request) {
+        callback(true, PA_USEC_INVALID);
+        return;
+    }
+
+    request->duration = duration;
+    request->op = pa_stream_update_timing_info(mStream, [] (pa_stream *stream, int success, void *user_data) {
+        struct latency_request *request = static_cast<struct latency_request*>(user_data);
+        FeedbackStreamResultCallback callback;
+        pa_usec_t latency = PA_USEC_INVALID;
+        pa_usec_t stream_latency;
+        int negative = 0;
+
+        pa_operation_unref(request->op);
+        request->op = NULL;
+
+        /* The stream latency covers everything up to the last byte we wrote,
+         * the sample itself starts playing its own duration earlier */
+        if (success && pa_stream_get_latency(stream, &stream_latency, &negative) == 0) {
+            if (negative || stream_latency < request->duration)
+                latency = 0;
+            else
+                latency = stream_latency - request->duration;
+        }
+
+        /* the slot is free again, it may be taken by whoever gets called */
+        callback.swap(request->callback);
+        callback(true, latency);
+    }, request);
+
+    if (!request->op) {
+        callback(true, PA_USEC_INVALID);
+        return;
+    }
+
+    request->callback.swap(callback);
+}
@@ -0,0 +1,71 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef FEEDBACKSTREAM_H
+#define FEEDBACKSTREAM_H
+
+#include <string>
+#include <functional>
+#include <glib.h>
+#include <pulse/pulseaudio.h>
+
+/* Called with the time it took until the sample started playing or
+ * PA_USEC_INVALID if it could not be measured */
+typedef std::function<void(bool, pa_usec_t)> FeedbackStreamResultCallback;
+
+class AudioService;
+struct Sample;
+struct latency_request;
+
+/* A playback stream kept open on the default sink with small buffers. Samples
+ * are written to it directly which gives a much tighter and more predictable
+ * latency than playing them from the sample cache of pulseaudio. It is corked
+ * while idle so it doesn't keep the sink from suspending. */
+class FeedbackStream
+{
+public:
+    explicit FeedbackStream(AudioService *service);
+    ~FeedbackStream();
+
+    void open(const char *sink, const pa_sample_spec *spec, const pa_channel_map *map);
+    void close();
+
+    bool can_play(const Sample *sample, const char *sink) const;
+    void play(const Sample *sample, FeedbackStreamResultCallback callback);
+
+private:
+    AudioService *mService;
+    pa_stream *mStream;
+    std::string mSink;
+    pa_sample_spec mSpec;
+    pa_channel_map mMap;
+    pa_usec_t mTargetLatency;
+    pa_volume_t mVolume;
+    /* slots for the latency measurements in flight, taken up front so
+     * playing never allocates */
+    struct latency_request *mRequests;
+    bool mCorked;
+    GSource *mIdleSource;
+
+    void cork(bool corked);
+
+    static void stream_state_cb(pa_stream *stream, void *user_data);
+    static gboolean idle_cb(gpointer user_data);
+};
+
+#endif // FEEDBACKSTREAM_H
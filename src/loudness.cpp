@@ -0,0 +1,270 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "loudness.h"
+#include "samplefile.h"
+
+/* Gating blocks are 400ms long and overlap by 75%, so we measure the energy
+ * of 100ms steps and combine four of them into a block */
+#define STEP_MSEC		100
+#define STEPS_PER_BLOCK		4
+#define ABSOLUTE_GATE		-70.0
+#define RELATIVE_GATE		-10.0
+/* Reported for silence */
+#define LOUDNESS_MINIMUM	-120.0
+
+struct biquad {
+    double b0, b1, b2, a1, a2;
+    double z1, z2;
+};
+
+static inline float biquad_process(struct biquad *filter, float input)
+{
+    double output = filter->b0 * input + filter->z1;
+
+    filter->z1 = filter->b1 * input - filter->a1 * output + filter->z2;
+    filter->z2 = filter->b2 * input - filter->a2 * output;
+
+    return (float) output;
+}
+
+/* The K-weighting pre-filter of ITU-R BS.1770 is a high shelf followed by a
+ * high pass. The standard only lists coefficients for 48kHz, these are the
+ * analog prototypes transformed for any rate. */
+static void k_weighting_init(struct biquad *shelf, struct biquad *highpass, unsigned int rate)
+{
+    double f0, gain, q, k, vh, vb, a0;
+
+    f0 = 1681.974450955533;
+    gain = 3.999843853973347;
+    q = 0.7071752369554196;
+
+    k = tan(M_PI * f0 / rate);
+    vh = pow(10.0, gain / 20.0);
+    vb = pow(vh, 0.4996667741545416);
+    a0 = 1.0 + k / q + k * k;
+
+    shelf->b0 = (vh + vb * k / q + k * k) / a0;
+    shelf->b1 = 2.0 * (k * k - vh) / a0;
+    shelf->b2 = (vh - vb * k / q + k * k) / a0;
+    shelf->a1 = 2.0 * (k * k - 1.0) / a0;
+    shelf->a2 = (1.0 - k / q + k * k) / a0;
+    shelf->z1 = shelf->z2 = 0.0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+
+    k = tan(M_PI * f0 / rate);
+    a0 = 1.0 + k / q + k * k;
+
+    highpass->b0 = 1.0;
+    highpass->b1 = -2.0;
+    highpass->b2 = 1.0;
+    highpass->a1 = 2.0 * (k * k - 1.0) / a0;
+    highpass->a2 = (1.0 - k / q + k * k) / a0;
+    highpass->z1 = highpass->z2 = 0.0;
+}
+
+static float sum_of_squares(const float *data, size_t count)
+{
+    size_t n = 0;
+    float sum;
+
+#if defined(__SSE__)
+    __m128 acc = _mm_setzero_ps();
+    float result[4];
+
+    for (; n + 4 <= count; n += 4) {
+        __m128 value = _mm_loadu_ps(data + n);
+        acc = _mm_add_ps(acc, _mm_mul_ps(value, value));
+    }
+
+    _mm_storeu_ps(result, acc);
+    sum = result[0] + result[1] + result[2] + result[3];
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    float32x2_t half;
+
+    for (; n + 4 <= count; n += 4) {
+        float32x4_t value = vld1q_f32(data + n);
+        acc = vmlaq_f32(acc, value, value);
+    }
+
+    half = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    sum = vget_lane_f32(vpadd_f32(half, half), 0);
+#else
+    sum = 0.0f;
+#endif
+
+    for (; n < count; n++)
+        sum += data[n] * data[n];
+
+    return sum;
+}
+
+static float peak_of(const float *data, size_t count)
+{
+    size_t n = 0;
+    float peak;
+
+#if defined(__SSE__)
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 acc = _mm_setzero_ps();
+    float result[4];
+
+    for (; n + 4 <= count; n += 4)
+        acc = _mm_max_ps(acc, _mm_andnot_ps(sign, _mm_loadu_ps(data + n)));
+
+    _mm_storeu_ps(result, acc);
+    peak = MAX(MAX(result[0], result[1]), MAX(result[2], result[3]));
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    float32x2_t half;
+
+    for (; n + 4 <= count; n += 4)
+        acc = vmaxq_f32(acc, vabsq_f32(vld1q_f32(data + n)));
+
+    half = vpmax_f32(vget_low_f32(acc), vget_high_f32(acc));
+    peak = vget_lane_f32(vpmax_f32(half, half), 0);
+#else
+    peak = 0.0f;
+#endif
+
+    for (; n < count; n++)
+        peak = MAX(peak, fabsf(data[n]));
+
+    return peak;
+}
+
+static double energy_to_loudness(double energy)
+{
+    if (energy <= 0.0)
+        return LOUDNESS_MINIMUM;
+
+    return MAX(-0.691 + 10.0 * log10(energy), LOUDNESS_MINIMUM);
+}
+
+bool loudness_analyze(const guint8 *data, size_t length, const pa_sample_spec *spec, Loudness *result)
+{
+    std::vector<float> samples, filtered;
+    std::vector<struct biquad> filters;
+    std::vector<double> steps, blocks;
+    size_t frames, step_frames, offset, count, n;
+    unsigned int channel;
+    double energy, gate, sum;
+    float peak;
+
+    switch (spec->format) {
+    case PA_SAMPLE_U8:
+    case PA_SAMPLE_S16LE:
+    case PA_SAMPLE_S24LE:
+    case PA_SAMPLE_S32LE:
+    case PA_SAMPLE_FLOAT32LE:
+        break;
+    default:
+        return false;
+    }
+
+    frames = length / pa_frame_size(spec);
+    if (frames == 0)
+        return false;
+
+    samples.resize(frames * spec->channels);
+    sample_file_decode(data, samples.size(), spec->format, &samples[0]);
+
+    peak = peak_of(&samples[0], samples.size());
+
+    /* two filters per channel, the shelf followed by the high pass */
+    filters.resize(spec->channels * 2);
+    for (channel = 0; channel < spec->channels; channel++)
+        k_weighting_init(&filters[channel * 2], &filters[channel * 2 + 1], spec->rate);
+
+    step_frames = MAX((size_t) spec->rate * STEP_MSEC / 1000, 1);
+    filtered.resize(step_frames);
+
+    /* Mean square of the weighted signal per step, summed over all channels.
+     * Feedback samples are mono or stereo so every channel is weighted the
+     * same. */
+    for (offset = 0; offset < frames; offset += step_frames) {
+        count = MIN(step_frames, frames - offset);
+        energy = 0.0;
+
+        for (channel = 0; channel < spec->channels; channel++) {
+            for (n = 0; n < count; n++) {
+                float value = samples[(offset + n) * spec->channels + channel];
+
+                value = biquad_process(&filters[channel * 2], value);
+                filtered[n] = biquad_process(&filters[channel * 2 + 1], value);
+            }
+
+            energy += sum_of_squares(&filtered[0], count);
+        }
+
+        steps.push_back(energy / count);
+    }
+
+    /* most feedback samples are shorter than a single gating block, those
+     * are measured as a whole */
+    if (steps.size() < STEPS_PER_BLOCK) {
+        sum = 0.0;
+        for (n = 0; n < steps.size(); n++)
+            sum += steps[n];
+        blocks.push_back(sum / steps.size());
+    }
+    else {
+        for (n = 0; n + STEPS_PER_BLOCK <= steps.size(); n++) {
+            sum = 0.0;
+            for (size_t step = 0; step < STEPS_PER_BLOCK; step++)
+                sum += steps[n + step];
+            blocks.push_back(sum / STEPS_PER_BLOCK);
+        }
+    }
+
+    /* blocks below the absolute gate, and then those more than 10 LU below
+     * the loudness of the remaining ones, don't count */
+    gate = ABSOLUTE_GATE;
+    for (int pass = 0; pass < 2; pass++) {
+        sum = 0.0;
+        count = 0;
+
+        for (n = 0; n < blocks.size(); n++) {
+            if (energy_to_loudness(blocks[n]) > gate) {
+                sum += blocks[n];
+                count++;
+            }
+        }
+
+        energy = count > 0 ? sum / count : 0.0;
+        gate = MAX(energy_to_loudness(energy) + RELATIVE_GATE, ABSOLUTE_GATE);
+    }
+
+    result->peak = peak > 0.0f ? MAX(20.0 * log10(peak), LOUDNESS_MINIMUM) : LOUDNESS_MINIMUM;
+    result->integrated = energy_to_loudness(energy);
+
+    return true;
+}
@@ -0,0 +1,38 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <stddef.h>
+#include <glib.h>
+#include <pulse/pulseaudio.h>
+
+struct Loudness {
+    /* sample peak in dBFS */
+    double peak;
+    /* gated integrated loudness in LUFS following EBU R128 */
+    double integrated;
+};
+
+/* Measures the loudness of a whole sample. It runs once per sample while
+ * preloading, the per sample kernels are vectorized where SSE or NEON is
+ * available. */
+bool loudness_analyze(const guint8 *data, size_t length, const pa_sample_spec *spec, Loudness *result);
+
+#endif // LOUDNESS_H
@@ -86,18 +86,27 @@ void luna_service_message_reply_success(LSMessage *message)
     luna_service_message_reply_success(LSMessageGetConnection(message), message);
 }
 
+/* The empty schema we validate everything against never changes so it is
+ * parsed only once instead of for every message. */
+static jschema_ref empty_schema(void)
+{
+	static jschema_ref schema = NULL;
+
+	if (!schema)
+		schema = jschema_parse(j_cstr_to_buffer("{}"), DOMOPT_NOOPT, NULL);
+
+	return schema;
+}
+
 jvalue_ref luna_service_message_parse_and_validate(const char *payload)
 {
-	jschema_ref input_schema = NULL;
 	jvalue_ref parsed_obj = NULL;
 	JSchemaInfo schema_info;
 
-	input_schema = jschema_parse(j_cstr_to_buffer("{}"), DOMOPT_NOOPT, NULL);
-	jschema_info_init(&schema_info, input_schema, NULL, NULL);
+	jschema_info_init(&schema_info, empty_schema(), NULL, NULL);
 
 	parsed_obj = jdom_parse(j_cstr_to_buffer(payload), DOMOPT_NOOPT, &schema_info);
 
-	jschema_release(&input_schema);
 	if (jis_null(parsed_obj))
 		return NULL;
 
@@ -120,27 +129,38 @@ bool luna_service_message_get_boolean(jvalue_ref parsed_obj, const char *name, b
 
 char* luna_service_message_get_string(jvalue_ref parsed_obj, const char *name, const char *default_value)
 {
-	jvalue_ref string_obj = NULL;
 	raw_buffer string_buf;
 
-	if (!jobject_get_exists(parsed_obj, j_str_to_buffer(name, strlen(name)), &string_obj) ||
-		!jis_string(string_obj))
+	string_buf = luna_service_message_get_string_buffer(parsed_obj, name);
+	if (!string_buf.m_str)
 		return g_strdup(default_value);
 
-	string_buf = jstring_get(string_obj);
+	return g_strndup(string_buf.m_str, string_buf.m_len);
+}
+
+/* Returns the string without copying it, the buffer is only valid as long as
+ * the parsed object is and not nul terminated. m_str is NULL if there is no
+ * string with the given name. */
+raw_buffer luna_service_message_get_string_buffer(jvalue_ref parsed_obj, const char *name)
+{
+	jvalue_ref string_obj = NULL;
+	raw_buffer string_buf = { NULL, 0 };
 
-	return g_strdup(string_buf.m_str);
+	if (!jobject_get_exists(parsed_obj, j_str_to_buffer(name, strlen(name)), &string_obj) ||
+		!jis_string(string_obj))
+		return string_buf;
+
+	return jstring_get_fast(string_obj);
 }
 
 bool luna_service_message_validate_and_send(LSHandle *handle, LSMessage *message, jvalue_ref reply_obj)
 {
-	jschema_ref response_schema = NULL;
+	jschema_ref response_schema = empty_schema();
 	LSError lserror;
 	bool success = true;
 
 	LSErrorInit(&lserror);
 
-	response_schema = jschema_parse (j_cstr_to_buffer("{}"), DOMOPT_NOOPT, NULL);
 	if(!response_schema) {
 		luna_service_message_reply_error_internal(handle, message);
 		return false;
@@ -153,8 +173,6 @@ bool luna_service_message_validate_and_send(LSHandle *handle, LSMessage *message
 		success = false;
 	}
 
-	jschema_release(&response_schema);
-
 	return success;
 }
 
@@ -177,22 +195,43 @@ bool luna_service_check_for_subscription_and_process(LSHandle *handle, LSMessage
 
 void luna_service_post_subscription(LSHandle *handle, const char *path, const char *method, jvalue_ref reply_obj)
 {
-	jschema_ref response_schema = NULL;
+	jschema_ref response_schema = empty_schema();
 	LSError lserror;
 
 	LSErrorInit(&lserror);
 
-	response_schema = jschema_parse (j_cstr_to_buffer("{}"), DOMOPT_NOOPT, NULL);
 	if(!response_schema)
-		goto cleanup;
+		return;
 
 	if (!LSSubscriptionPost(handle, path, method,
 						jvalue_tostring(reply_obj, response_schema), &lserror)) {
 		LSErrorPrint(&lserror, stderr);
 		LSErrorFree(&lserror);
 	}
+}
 
-cleanup:
-	if (response_schema)
-		jschema_release(&response_schema);
+/* For replies serialized up front, e.g. kept around for replying to the same
+ * request over and over */
+void luna_service_message_reply_payload(LSHandle *handle, LSMessage *message, const char *payload)
+{
+	LSError lserror;
+
+	LSErrorInit(&lserror);
+
+	if (!LSMessageReply(handle, message, payload, &lserror)) {
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
+}
+
+void luna_service_post_subscription_payload(LSHandle *handle, const char *path, const char *method, const char *payload)
+{
+	LSError lserror;
+
+	LSErrorInit(&lserror);
+
+	if (!LSSubscriptionPost(handle, path, method, payload, &lserror)) {
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
 }
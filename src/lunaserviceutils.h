@@ -36,7 +36,10 @@ jvalue_ref luna_service_message_parse_and_validate(const char *payload);
 bool luna_service_message_validate_and_send(LSHandle *handle, LSMessage *message, jvalue_ref reply_obj);
 bool luna_service_check_for_subscription_and_process(LSHandle *handle, LSMessage *message);
 void luna_service_post_subscription(LSHandle *handle, const char *path, const char *method, jvalue_ref reply_obj);
+void luna_service_message_reply_payload(LSHandle *handle, LSMessage *message, const char *payload);
+void luna_service_post_subscription_payload(LSHandle *handle, const char *path, const char *method, const char *payload);
 bool luna_service_message_get_boolean(jvalue_ref parsed_obj, const char *name, bool default_value);
 char* luna_service_message_get_string(jvalue_ref parsed_obj, const char *name, const char *default_value);
+raw_buffer luna_service_message_get_string_buffer(jvalue_ref parsed_obj, const char *name);
 
 #endif
@@ -0,0 +1,538 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <string.h>
+
+#include "pulsemirror.h"
+
+/* States of an object in mQueries */
+#define QUERY_RUNNING	1
+#define QUERY_STALE	2
+
+struct PulseMirror::Query {
+    PulseMirror *mirror;
+    PulseObjectType type;
+    uint32_t index;
+    bool list;
+};
+
+struct PulseMirror::Waiter {
+    PulseMirror *mirror;
+    std::function<void()> callback;
+    bool ready;
+};
+
+template<typename Port>
+static void copy_ports(std::vector<PulsePort> &ports, std::string &active_port,
+                       Port **info_ports, uint32_t n_ports, const Port *info_active_port)
+{
+    uint32_t n;
+
+    ports.clear();
+
+    for (n = 0; n < n_ports; n++) {
+        PulsePort port;
+
+        port.name = info_ports[n]->name;
+        port.priority = info_ports[n]->priority;
+        port.available = info_ports[n]->available != PA_PORT_AVAILABLE_NO;
+
+        ports.push_back(port);
+    }
+
+    active_port = info_active_port ? info_active_port->name : "";
+}
+
+static const PulsePort* find_port(const std::vector<PulsePort> &ports, const char *name)
+{
+    for (const PulsePort &port : ports) {
+        if (port.name == name)
+            return &port;
+    }
+
+    return NULL;
+}
+
+const PulsePort* PulseSink::port(const char *name) const
+{
+    return find_port(ports, name);
+}
+
+const PulsePort* PulseSource::port(const char *name) const
+{
+    return find_port(ports, name);
+}
+
+PulseMirror::PulseMirror(pa_context *context) :
+    mContext(context),
+    mPending(0),
+    mListsPending(0),
+    mPopulated(false),
+    mWaiters(0)
+{
+    unsigned int n;
+
+    mObjects[PULSE_OBJECT_SINK] = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+        [] (gpointer object) { delete static_cast<PulseSink*>(object); });
+    mObjects[PULSE_OBJECT_SOURCE] = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+        [] (gpointer object) { delete static_cast<PulseSource*>(object); });
+    mObjects[PULSE_OBJECT_SINK_INPUT] = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+        [] (gpointer object) { delete static_cast<PulseSinkInput*>(object); });
+    mObjects[PULSE_OBJECT_SOURCE_OUTPUT] = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+        [] (gpointer object) { delete static_cast<PulseSourceOutput*>(object); });
+    mObjects[PULSE_OBJECT_CARD] = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+        [] (gpointer object) { delete static_cast<PulseCard*>(object); });
+
+    for (n = 0; n <= PULSE_OBJECT_SERVER; n++)
+        mQueries[n] = g_hash_table_new(g_direct_hash, g_direct_equal);
+}
+
+PulseMirror::~PulseMirror()
+{
+    unsigned int n;
+
+    for (n = 0; n < PULSE_OBJECT_SERVER; n++)
+        g_hash_table_destroy(mObjects[n]);
+
+    for (n = 0; n <= PULSE_OBJECT_SERVER; n++)
+        g_hash_table_destroy(mQueries[n]);
+
+    for (GList *iter = mWaiters; iter; iter = iter->next)
+        delete static_cast<Waiter*>(iter->data);
+    g_list_free(mWaiters);
+}
+
+void PulseMirror::populate()
+{
+    static const PulseObjectType types[] = {
+        PULSE_OBJECT_SERVER,
+        PULSE_OBJECT_CARD,
+        PULSE_OBJECT_SINK,
+        PULSE_OBJECT_SOURCE,
+        PULSE_OBJECT_SINK_INPUT,
+        PULSE_OBJECT_SOURCE_OUTPUT
+    };
+    unsigned int n;
+
+    for (n = 0; n < G_N_ELEMENTS(types); n++) {
+        Query *query = new Query { this, types[n], PA_INVALID_INDEX, true };
+        pa_operation *op = NULL;
+
+        switch (types[n]) {
+        case PULSE_OBJECT_SERVER:
+            op = pa_context_get_server_info(mContext, server_info_cb, query);
+            break;
+        case PULSE_OBJECT_CARD:
+            op = pa_context_get_card_info_list(mContext, card_info_cb, query);
+            break;
+        case PULSE_OBJECT_SINK:
+            op = pa_context_get_sink_info_list(mContext, sink_info_cb, query);
+            break;
+        case PULSE_OBJECT_SOURCE:
+            op = pa_context_get_source_info_list(mContext, source_info_cb, query);
+            break;
+        case PULSE_OBJECT_SINK_INPUT:
+            op = pa_context_get_sink_input_info_list(mContext, sink_input_info_cb, query);
+            break;
+        case PULSE_OBJECT_SOURCE_OUTPUT:
+            op = pa_context_get_source_output_info_list(mContext, source_output_info_cb, query);
+            break;
+        }
+
+        if (!op) {
+            g_warning("Failed to query pulseaudio objects of type %d", types[n]);
+            delete query;
+            continue;
+        }
+
+        pa_operation_unref(op);
+        mPending++;
+        mListsPending++;
+    }
+
+    mPopulated = mListsPending == 0;
+}
+
+void PulseMirror::event(pa_subscription_event_type_t type, uint32_t index)
+{
+    PulseObjectType object_type;
+
+    switch (type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) {
+    case PA_SUBSCRIPTION_EVENT_SINK:
+        object_type = PULSE_OBJECT_SINK;
+        break;
+    case PA_SUBSCRIPTION_EVENT_SOURCE:
+        object_type = PULSE_OBJECT_SOURCE;
+        break;
+    case PA_SUBSCRIPTION_EVENT_SINK_INPUT:
+        object_type = PULSE_OBJECT_SINK_INPUT;
+        break;
+    case PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT:
+        object_type = PULSE_OBJECT_SOURCE_OUTPUT;
+        break;
+    case PA_SUBSCRIPTION_EVENT_CARD:
+        object_type = PULSE_OBJECT_CARD;
+        break;
+    case PA_SUBSCRIPTION_EVENT_SERVER:
+        query(PULSE_OBJECT_SERVER, 0);
+        return;
+    default:
+        return;
+    }
+
+    if ((type & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE) {
+        remove(object_type, index);
+        return;
+    }
+
+    query(object_type, index);
+}
+
+void PulseMirror::query(PulseObjectType type, uint32_t index)
+{
+    Query *query;
+    pa_operation *op = NULL;
+
+    /* the query in flight may have been answered before this change, one
+     * more once it is done is enough for any number of them */
+    if (g_hash_table_contains(mQueries[type], GUINT_TO_POINTER(index))) {
+        g_hash_table_insert(mQueries[type], GUINT_TO_POINTER(index), GUINT_TO_POINTER(QUERY_STALE));
+        return;
+    }
+
+    query = new Query { this, type, index, false };
+
+    switch (type) {
+    case PULSE_OBJECT_SINK:
+        op = pa_context_get_sink_info_by_index(mContext, index, sink_info_cb, query);
+        break;
+    case PULSE_OBJECT_SOURCE:
+        op = pa_context_get_source_info_by_index(mContext, index, source_info_cb, query);
+        break;
+    case PULSE_OBJECT_SINK_INPUT:
+        op = pa_context_get_sink_input_info(mContext, index, sink_input_info_cb, query);
+        break;
+    case PULSE_OBJECT_SOURCE_OUTPUT:
+        op = pa_context_get_source_output_info(mContext, index, source_output_info_cb, query);
+        break;
+    case PULSE_OBJECT_CARD:
+        op = pa_context_get_card_info_by_index(mContext, index, card_info_cb, query);
+        break;
+    case PULSE_OBJECT_SERVER:
+        op = pa_context_get_server_info(mContext, server_info_cb, query);
+        break;
+    }
+
+    if (!op) {
+        delete query;
+        return;
+    }
+
+    pa_operation_unref(op);
+
+    g_hash_table_insert(mQueries[type], GUINT_TO_POINTER(index), GUINT_TO_POINTER(QUERY_RUNNING));
+    mPending++;
+}
+
+void PulseMirror::query_done(Query *query, bool failed)
+{
+    gpointer state;
+
+    mPending--;
+
+    if (!query->list) {
+        state = g_hash_table_lookup(mQueries[query->type], GUINT_TO_POINTER(query->index));
+        g_hash_table_remove(mQueries[query->type], GUINT_TO_POINTER(query->index));
+
+        /* a single object we can't get any longer is gone */
+        if (failed && query->type != PULSE_OBJECT_SERVER)
+            remove(query->type, query->index);
+        else if (GPOINTER_TO_UINT(state) == QUERY_STALE)
+            this->query(query->type, query->index);
+    }
+    else if (--mListsPending == 0) {
+        mPopulated = true;
+    }
+
+    delete query;
+
+    check_settled();
+}
+
+void PulseMirror::store(PulseObjectType type, uint32_t index, gpointer object)
+{
+    bool existed;
+
+    existed = g_hash_table_contains(mObjects[type], GUINT_TO_POINTER(index));
+    g_hash_table_replace(mObjects[type], GUINT_TO_POINTER(index), object);
+
+    if (mListener)
+        mListener(type, index, existed ? PULSE_OBJECT_CHANGED : PULSE_OBJECT_ADDED);
+}
+
+void PulseMirror::remove(PulseObjectType type, uint32_t index)
+{
+    if (!g_hash_table_remove(mObjects[type], GUINT_TO_POINTER(index)))
+        return;
+
+    if (mListener)
+        mListener(type, index, PULSE_OBJECT_REMOVED);
+}
+
+void PulseMirror::store_server(const pa_server_info *info)
+{
+    const char *sink_name = info->default_sink_name ? info->default_sink_name : "";
+    const char *source_name = info->default_source_name ? info->default_source_name : "";
+
+    if (mDefaultSinkName == sink_name && mDefaultSourceName == source_name)
+        return;
+
+    mDefaultSinkName = sink_name;
+    mDefaultSourceName = source_name;
+
+    if (mListener)
+        mListener(PULSE_OBJECT_SERVER, 0, PULSE_OBJECT_CHANGED);
+}
+
+void PulseMirror::when_settled(std::function<void()> callback)
+{
+    Waiter *waiter;
+    pa_operation *op;
+
+    waiter = new Waiter { this, callback, false };
+    mWaiters = g_list_append(mWaiters, waiter);
+
+    /* Events about what happened so far are sent before the reply to this
+     * and the queries for them go out before it is received. Once it is in
+     * and no query is left everything is up to date. */
+    op = pa_context_get_server_info(mContext, [] (pa_context *context, const pa_server_info *info, void *user_data) {
+        Waiter *waiter = static_cast<Waiter*>(user_data);
+
+        if (info)
+            waiter->mirror->store_server(info);
+
+        waiter->ready = true;
+        waiter->mirror->check_settled();
+    }, waiter);
+
+    if (!op) {
+        waiter->ready = true;
+        check_settled();
+        return;
+    }
+
+    pa_operation_unref(op);
+}
+
+void PulseMirror::check_settled()
+{
+    GList *ready = NULL;
+    GList *iter, *next;
+
+    if (mPending > 0)
+        return;
+
+    for (iter = mWaiters; iter; iter = next) {
+        next = iter->next;
+
+        if (static_cast<Waiter*>(iter->data)->ready) {
+            ready = g_list_append(ready, iter->data);
+            mWaiters = g_list_delete_link(mWaiters, iter);
+        }
+    }
+
+    /* callbacks may wait for the next round themselves */
+    for (iter = ready; iter; iter = iter->next) {
+        Waiter *waiter = static_cast<Waiter*>(iter->data);
+
+        waiter->callback();
+        delete waiter;
+    }
+
+    g_list_free(ready);
+}
+
+const PulseSink* PulseMirror::sink(uint32_t index) const
+{
+    return static_cast<const PulseSink*>(g_hash_table_lookup(mObjects[PULSE_OBJECT_SINK], GUINT_TO_POINTER(index)));
+}
+
+const PulseSink* PulseMirror::default_sink() const
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    g_hash_table_iter_init(&iter, mObjects[PULSE_OBJECT_SINK]);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        const PulseSink *sink = static_cast<const PulseSink*>(value);
+
+        if (sink->name == mDefaultSinkName)
+            return sink;
+    }
+
+    return NULL;
+}
+
+const PulseSource* PulseMirror::source(uint32_t index) const
+{
+    return static_cast<const PulseSource*>(g_hash_table_lookup(mObjects[PULSE_OBJECT_SOURCE], GUINT_TO_POINTER(index)));
+}
+
+const PulseCard* PulseMirror::card(uint32_t index) const
+{
+    return static_cast<const PulseCard*>(g_hash_table_lookup(mObjects[PULSE_OBJECT_CARD], GUINT_TO_POINTER(index)));
+}
+
+const PulseSinkInput* PulseMirror::sink_input(uint32_t index) const
+{
+    return static_cast<const PulseSinkInput*>(g_hash_table_lookup(mObjects[PULSE_OBJECT_SINK_INPUT], GUINT_TO_POINTER(index)));
+}
+
+const PulseSourceOutput* PulseMirror::source_output(uint32_t index) const
+{
+    return static_cast<const PulseSourceOutput*>(g_hash_table_lookup(mObjects[PULSE_OBJECT_SOURCE_OUTPUT], GUINT_TO_POINTER(index)));
+}
+
+/* All info callbacks end up here without info once the query is done or
+ * failed, for a single object also if it is gone already */
+
+void PulseMirror::sink_info_cb(pa_context *context, const pa_sink_info *info, int eol, void *user_data)
+{
+    Query *query = static_cast<Query*>(user_data);
+    PulseSink *sink;
+
+    if (!info) {
+        query->mirror->query_done(query, eol < 0);
+        return;
+    }
+
+    sink = new PulseSink;
+    sink->index = info->index;
+    sink->name = info->name;
+    sink->sample_spec = info->sample_spec;
+    sink->channel_map = info->channel_map;
+    sink->volume = info->volume;
+    sink->mute = info->mute;
+    copy_ports(sink->ports, sink->active_port, info->ports, info->n_ports, info->active_port);
+
+    query->mirror->store(PULSE_OBJECT_SINK, info->index, sink);
+}
+
+void PulseMirror::source_info_cb(pa_context *context, const pa_source_info *info, int eol, void *user_data)
+{
+    Query *query = static_cast<Query*>(user_data);
+    PulseSource *source;
+
+    if (!info) {
+        query->mirror->query_done(query, eol < 0);
+        return;
+    }
+
+    source = new PulseSource;
+    source->index = info->index;
+    source->name = info->name;
+    source->volume = info->volume;
+    source->mute = info->mute;
+    source->monitor_of_sink = info->monitor_of_sink;
+    copy_ports(source->ports, source->active_port, info->ports, info->n_ports, info->active_port);
+
+    query->mirror->store(PULSE_OBJECT_SOURCE, info->index, source);
+}
+
+void PulseMirror::sink_input_info_cb(pa_context *context, const pa_sink_input_info *info, int eol, void *user_data)
+{
+    Query *query = static_cast<Query*>(user_data);
+    PulseSinkInput *input;
+    const char *value;
+
+    if (!info) {
+        query->mirror->query_done(query, eol < 0);
+        return;
+    }
+
+    input = new PulseSinkInput;
+    input->index = info->index;
+    input->sink = info->sink;
+    input->client = info->client;
+    value = pa_proplist_gets(info->proplist, PA_PROP_MEDIA_ROLE);
+    input->role = value ? value : "";
+    value = pa_proplist_gets(info->proplist, PA_PROP_APPLICATION_PROCESS_ID);
+    input->process_id = value ? value : "";
+    input->volume = info->volume;
+    input->has_volume = info->has_volume;
+    input->volume_writable = info->volume_writable;
+
+    query->mirror->store(PULSE_OBJECT_SINK_INPUT, info->index, input);
+}
+
+void PulseMirror::source_output_info_cb(pa_context *context, const pa_source_output_info *info, int eol, void *user_data)
+{
+    Query *query = static_cast<Query*>(user_data);
+    PulseSourceOutput *output;
+
+    if (!info) {
+        query->mirror->query_done(query, eol < 0);
+        return;
+    }
+
+    output = new PulseSourceOutput;
+    output->index = info->index;
+    output->source = info->source;
+    output->client = info->client;
+
+    query->mirror->store(PULSE_OBJECT_SOURCE_OUTPUT, info->index, output);
+}
+
+void PulseMirror::card_info_cb(pa_context *context, const pa_card_info *info, int eol, void *user_data)
+{
+    Query *query = static_cast<Query*>(user_data);
+    PulseCard *card;
+    uint32_t n;
+
+    if (!info) {
+        query->mirror->query_done(query, eol < 0);
+        return;
+    }
+
+    card = new PulseCard;
+    card->index = info->index;
+    card->name = info->name;
+
+    for (n = 0; n < info->n_profiles; n++) {
+        PulseCardProfile profile;
+
+        profile.name = info->profiles[n].name;
+        profile.priority = info->profiles[n].priority;
+
+        card->profiles.push_back(profile);
+    }
+
+    card->active_profile = info->active_profile ? info->active_profile->name : "";
+
+    query->mirror->store(PULSE_OBJECT_CARD, info->index, card);
+}
+
+void PulseMirror::server_info_cb(pa_context *context, const pa_server_info *info, void *user_data)
+{
+    Query *query = static_cast<Query*>(user_data);
+
+    if (info)
+        query->mirror->store_server(info);
+
+    query->mirror->query_done(query, !info);
+}
@@ -0,0 +1,177 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef PULSEMIRROR_H
+#define PULSEMIRROR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <glib.h>
+#include <pulse/pulseaudio.h>
+
+enum PulseObjectType {
+    PULSE_OBJECT_SINK,
+    PULSE_OBJECT_SOURCE,
+    PULSE_OBJECT_SINK_INPUT,
+    PULSE_OBJECT_SOURCE_OUTPUT,
+    PULSE_OBJECT_CARD,
+    PULSE_OBJECT_SERVER
+};
+
+enum PulseObjectChange {
+    PULSE_OBJECT_ADDED,
+    PULSE_OBJECT_CHANGED,
+    PULSE_OBJECT_REMOVED
+};
+
+struct PulsePort {
+    std::string name;
+    uint32_t priority;
+    bool available;
+};
+
+struct PulseSink {
+    uint32_t index;
+    std::string name;
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+    pa_cvolume volume;
+    bool mute;
+    std::vector<PulsePort> ports;
+    std::string active_port;
+
+    const PulsePort* port(const char *name) const;
+};
+
+struct PulseSource {
+    uint32_t index;
+    std::string name;
+    pa_cvolume volume;
+    bool mute;
+    uint32_t monitor_of_sink;
+    std::vector<PulsePort> ports;
+    std::string active_port;
+
+    const PulsePort* port(const char *name) const;
+};
+
+struct PulseCardProfile {
+    std::string name;
+    uint32_t priority;
+};
+
+struct PulseCard {
+    uint32_t index;
+    std::string name;
+    std::vector<PulseCardProfile> profiles;
+    std::string active_profile;
+};
+
+struct PulseSinkInput {
+    uint32_t index;
+    uint32_t sink;
+    uint32_t client;
+    std::string role;
+    std::string process_id;
+    pa_cvolume volume;
+    bool has_volume;
+    bool volume_writable;
+};
+
+struct PulseSourceOutput {
+    uint32_t index;
+    uint32_t source;
+    uint32_t client;
+};
+
+/* Told about every object added, changed or removed. For the server index is
+ * 0 and the change is about the default sink or source. */
+typedef std::function<void(PulseObjectType, uint32_t, PulseObjectChange)> PulseMirrorListener;
+
+/* Copy of the pulseaudio objects we care about, keyed by their index. It is
+ * filled once after connecting and from then on kept up to date by querying
+ * just the object a subscription event is about. Queries of the same object
+ * don't pile up, a burst of events ends up as at most two of them. */
+class PulseMirror
+{
+public:
+    explicit PulseMirror(pa_context *context);
+    ~PulseMirror();
+
+    void set_listener(PulseMirrorListener listener) { mListener = listener; }
+
+    void populate();
+    /* whether everything there when connecting is in */
+    bool populated() const { return mPopulated; }
+    void event(pa_subscription_event_type_t type, uint32_t index);
+
+    /* Called once everything pulseaudio told us about until now is in, e.g.
+     * the sinks of a card profile just switched to */
+    void when_settled(std::function<void()> callback);
+
+    /* NULL until the server told us */
+    const char* default_sink_name() const { return mDefaultSinkName.empty() ? NULL : mDefaultSinkName.c_str(); }
+    const char* default_source_name() const { return mDefaultSourceName.empty() ? NULL : mDefaultSourceName.c_str(); }
+
+    const PulseSink* sink(uint32_t index) const;
+    const PulseSink* default_sink() const;
+    const PulseSource* source(uint32_t index) const;
+    const PulseCard* card(uint32_t index) const;
+    const PulseSinkInput* sink_input(uint32_t index) const;
+    const PulseSourceOutput* source_output(uint32_t index) const;
+
+    /* index to object, for iterating with GHashTableIter */
+    GHashTable* sinks() const { return mObjects[PULSE_OBJECT_SINK]; }
+    GHashTable* sources() const { return mObjects[PULSE_OBJECT_SOURCE]; }
+    GHashTable* cards() const { return mObjects[PULSE_OBJECT_CARD]; }
+    GHashTable* sink_inputs() const { return mObjects[PULSE_OBJECT_SINK_INPUT]; }
+
+private:
+    struct Query;
+    struct Waiter;
+
+    pa_context *mContext;
+    PulseMirrorListener mListener;
+    GHashTable *mObjects[PULSE_OBJECT_SERVER];
+    /* per type, index of each object queried to its state */
+    GHashTable *mQueries[PULSE_OBJECT_SERVER + 1];
+    unsigned int mPending;
+    unsigned int mListsPending;
+    bool mPopulated;
+    GList *mWaiters;
+    std::string mDefaultSinkName;
+    std::string mDefaultSourceName;
+
+    void query(PulseObjectType type, uint32_t index);
+    void query_done(Query *query, bool failed);
+    void store(PulseObjectType type, uint32_t index, gpointer object);
+    void remove(PulseObjectType type, uint32_t index);
+    void store_server(const pa_server_info *info);
+    void check_settled();
+
+    static void sink_info_cb(pa_context *context, const pa_sink_info *info, int eol, void *user_data);
+    static void source_info_cb(pa_context *context, const pa_source_info *info, int eol, void *user_data);
+    static void sink_input_info_cb(pa_context *context, const pa_sink_input_info *info, int eol, void *user_data);
+    static void source_output_info_cb(pa_context *context, const pa_source_output_info *info, int eol, void *user_data);
+    static void card_info_cb(pa_context *context, const pa_card_info *info, int eol, void *user_data);
+    static void server_info_cb(pa_context *context, const pa_server_info *info, void *user_data);
+};
+
+#endif // PULSEMIRROR_H
@@ -0,0 +1,171 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <math.h>
+#include <string.h>
+
+#include <glib.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "resampler.h"
+
+/* Taps per phase, needs to be a multiple of 4 for the vectorized kernels */
+#define FILTER_TAPS		32
+/* Upper bound for the number of filter phases we precompute. Rate pairs
+ * needing more phases than that use the nearest precomputed one. */
+#define MAX_PHASES		1024
+/* Start of the transition band relative to the lower of both nyquist rates */
+#define FILTER_CUTOFF		0.95
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+    while (b != 0) {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+static double sinc(double x)
+{
+    if (fabs(x) < 1e-9)
+        return 1.0;
+
+    return sin(M_PI * x) / (M_PI * x);
+}
+
+/* Blackman window over [-1;1] */
+static double window(double x)
+{
+    if (fabs(x) >= 1.0)
+        return 0.0;
+
+    return 0.42 + 0.5 * cos(M_PI * x) + 0.08 * cos(2.0 * M_PI * x);
+}
+
+static inline float dot_product(const float *a, const float *b)
+{
+#if defined(__SSE__)
+    __m128 sum = _mm_setzero_ps();
+    float result[4];
+
+    for (int i = 0; i < FILTER_TAPS; i += 4)
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+
+    _mm_storeu_ps(result, sum);
+
+    return result[0] + result[1] + result[2] + result[3];
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    float32x2_t half;
+
+    for (int i = 0; i < FILTER_TAPS; i += 4)
+        sum = vmlaq_f32(sum, vld1q_f32(a + i), vld1q_f32(b + i));
+
+    half = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+
+    return vget_lane_f32(vpadd_f32(half, half), 0);
+#else
+    float sum = 0.0f;
+
+    for (int i = 0; i < FILTER_TAPS; i++)
+        sum += a[i] * b[i];
+
+    return sum;
+#endif
+}
+
+Resampler::Resampler(unsigned int input_rate, unsigned int output_rate) :
+    mInterpolation(1),
+    mDecimation(1),
+    mPhases(1),
+    mFilter(0)
+{
+    unsigned int divisor = gcd(input_rate, output_rate);
+    double cutoff, gain, distance;
+    unsigned int phase, tap;
+
+    mInterpolation = output_rate / divisor;
+    mDecimation = input_rate / divisor;
+    mPhases = MIN(mInterpolation, MAX_PHASES);
+
+    /* when decimating the filter needs to cut off at the output nyquist rate */
+    cutoff = FILTER_CUTOFF * MIN(1.0, (double) output_rate / input_rate);
+
+    mFilter = g_new(float, mPhases * FILTER_TAPS);
+
+    for (phase = 0; phase < mPhases; phase++) {
+        float *coefficients = mFilter + phase * FILTER_TAPS;
+
+        gain = 0.0;
+
+        for (tap = 0; tap < FILTER_TAPS; tap++) {
+            /* distance of the tap to the output position, in input samples */
+            distance = (double) tap - (FILTER_TAPS / 2 - 1) - (double) phase / mPhases;
+            coefficients[tap] = cutoff * sinc(cutoff * distance) * window(distance / (FILTER_TAPS / 2));
+            gain += coefficients[tap];
+        }
+
+        /* normalize every phase to unity gain to avoid ripple on DC */
+        for (tap = 0; tap < FILTER_TAPS; tap++)
+            coefficients[tap] /= gain;
+    }
+}
+
+Resampler::~Resampler()
+{
+    g_free(mFilter);
+}
+
+size_t Resampler::output_frames(size_t input_frames) const
+{
+    return ((guint64) input_frames * mInterpolation + mDecimation - 1) / mDecimation;
+}
+
+void Resampler::process(const float *input, size_t input_frames, float *output) const
+{
+    size_t frames = output_frames(input_frames);
+    size_t padded_frames = input_frames + FILTER_TAPS;
+    float *padded;
+    guint64 position;
+    size_t n, index;
+    unsigned int phase;
+
+    /* pad both ends with silence so the kernel never needs bounds checks */
+    padded = g_new0(float, padded_frames + FILTER_TAPS);
+    memcpy(padded + FILTER_TAPS / 2, input, input_frames * sizeof(float));
+
+    for (n = 0; n < frames; n++) {
+        position = (guint64) n * mDecimation;
+        index = position / mInterpolation;
+        phase = (unsigned int) ((position % mInterpolation) * mPhases / mInterpolation);
+
+        /* the first tap sits FILTER_TAPS / 2 - 1 samples before the input
+         * sample at index which itself starts FILTER_TAPS / 2 into padded */
+        output[n] = dot_product(mFilter + phase * FILTER_TAPS, padded + index + 1);
+    }
+
+    g_free(padded);
+}
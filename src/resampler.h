@@ -0,0 +1,43 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stddef.h>
+
+/* Windowed sinc polyphase resampler for planar float data. It is only used
+ * once per sample while preloading, so it favours quality over speed, but the
+ * inner product is vectorized where SSE or NEON is available. */
+class Resampler
+{
+public:
+    Resampler(unsigned int input_rate, unsigned int output_rate);
+    ~Resampler();
+
+    size_t output_frames(size_t input_frames) const;
+    void process(const float *input, size_t input_frames, float *output) const;
+
+private:
+    unsigned int mInterpolation;
+    unsigned int mDecimation;
+    unsigned int mPhases;
+    float *mFilter;
+};
+
+#endif // RESAMPLER_H
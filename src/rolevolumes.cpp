@@ -0,0 +1,133 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "rolevolumes.h"
+#include "audioservice.h"
+#include "pulsemirror.h"
+
+static const char *role_names[] = {
+    "media",
+    "ringtone",
+    "phone",
+    "system"
+};
+
+/* media.role values which don't belong to media, which is where everything
+ * else ends up */
+static const struct {
+    const char *name;
+    VolumeRole role;
+} stream_roles[] = {
+    { "ringtone", VOLUME_ROLE_RINGTONE },
+    { "phone", VOLUME_ROLE_PHONE },
+    { "event", VOLUME_ROLE_SYSTEM },
+    { "a11y", VOLUME_ROLE_SYSTEM }
+};
+
+const char* volume_role_name(VolumeRole role)
+{
+    return role_names[role];
+}
+
+static VolumeRole role_from_stream(const std::string &stream_role)
+{
+    unsigned int n;
+
+    for (n = 0; n < G_N_ELEMENTS(stream_roles); n++) {
+        if (stream_role == stream_roles[n].name)
+            return stream_roles[n].role;
+    }
+
+    return VOLUME_ROLE_MEDIA;
+}
+
+RoleVolumes::RoleVolumes(AudioService *service) :
+    mService(service),
+    mProcessId(0)
+{
+    unsigned int n;
+
+    for (n = 0; n < VOLUME_ROLE_COUNT; n++)
+        mVolumes[n] = PA_VOLUME_NORM;
+
+    /* pulseaudio tags all streams of a client with its process id */
+    mProcessId = g_strdup_printf("%d", (int) getpid());
+}
+
+RoleVolumes::~RoleVolumes()
+{
+    g_free(mProcessId);
+}
+
+void RoleVolumes::set_volume(VolumeRole role, pa_volume_t volume)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    if (mVolumes[role] == volume)
+        return;
+
+    mVolumes[role] = volume;
+
+    /* nothing to apply it to before connecting */
+    if (!mService->pulse_mirror())
+        return;
+
+    g_hash_table_iter_init(&iter, mService->pulse_mirror()->sink_inputs());
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        const PulseSinkInput *input = static_cast<const PulseSinkInput*>(value);
+
+        if (managed(input) && role_from_stream(input->role) == role)
+            apply_to(input);
+    }
+}
+
+pa_volume_t RoleVolumes::apply(VolumeRole role, pa_volume_t volume) const
+{
+    return pa_sw_volume_multiply(volume, mVolumes[role]);
+}
+
+bool RoleVolumes::managed(const PulseSinkInput *input) const
+{
+    return input->has_volume && input->volume_writable && input->volume.channels > 0 &&
+           input->process_id != mProcessId;
+}
+
+void RoleVolumes::apply_to(const PulseSinkInput *input)
+{
+    pa_cvolume cvolume;
+    pa_operation *op;
+
+    pa_cvolume_set(&cvolume, input->volume.channels, mVolumes[role_from_stream(input->role)]);
+
+    /* the stream may be gone already, nothing to do about failures */
+    op = pa_context_set_sink_input_volume(mService->context(), input->index, &cvolume, NULL, NULL);
+    if (op)
+        pa_operation_unref(op);
+}
+
+void RoleVolumes::sink_input_added(const PulseSinkInput *input)
+{
+    /* later changes of a stream are ours or don't change its role */
+    if (managed(input) &&
+        !pa_cvolume_channels_equal_to(&input->volume, mVolumes[role_from_stream(input->role)]))
+        apply_to(input);
+}
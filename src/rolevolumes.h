@@ -0,0 +1,68 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef ROLEVOLUMES_H
+#define ROLEVOLUMES_H
+
+#include <stdint.h>
+#include <glib.h>
+#include <pulse/pulseaudio.h>
+
+enum VolumeRole {
+    VOLUME_ROLE_MEDIA,
+    VOLUME_ROLE_RINGTONE,
+    VOLUME_ROLE_PHONE,
+    VOLUME_ROLE_SYSTEM,
+    VOLUME_ROLE_COUNT
+};
+
+const char* volume_role_name(VolumeRole role);
+
+class AudioService;
+struct PulseSinkInput;
+
+/* Volumes for the different kinds of streams. Every sink input is sorted into
+ * one of the roles by its media.role property as soon as it shows up in the
+ * mirror of pulseaudio and gets the volume of that role. Our own feedback
+ * streams are left alone, their volume is applied when playing them. */
+class RoleVolumes
+{
+public:
+    explicit RoleVolumes(AudioService *service);
+    ~RoleVolumes();
+
+    pa_volume_t volume(VolumeRole role) const { return mVolumes[role]; }
+    void set_volume(VolumeRole role, pa_volume_t volume);
+
+    /* volume scaled by the one of role */
+    pa_volume_t apply(VolumeRole role, pa_volume_t volume) const;
+
+    /* a stream which just appeared, including those already there when
+     * connecting */
+    void sink_input_added(const PulseSinkInput *input);
+
+private:
+    AudioService *mService;
+    pa_volume_t mVolumes[VOLUME_ROLE_COUNT];
+    char *mProcessId;
+
+    bool managed(const PulseSinkInput *input) const;
+    void apply_to(const PulseSinkInput *input);
+};
+
+#endif // ROLEVOLUMES_H
@@ -0,0 +1,1239 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <gio/gio.h>
+
+#include "samplecache.h"
+#include "audioservice.h"
+#include "settings.h"
+#include "samplefile.h"
+#include "loudness.h"
+
+#define SAMPLE_PATH		"/usr/share/systemsounds"
+#define DECODE_CACHE_PATH	"/var/cache/audio-service/samples"
+
+/* Properties attached to every sample we upload so we can tell after a
+ * restart whether what pulseaudio still has is up to date */
+#define SAMPLE_PROP_SOURCE		"audio-service.source"
+#define SAMPLE_PROP_SOURCE_SIZE		"audio-service.source.size"
+#define SAMPLE_PROP_SOURCE_MTIME	"audio-service.source.mtime"
+#define SAMPLE_PROP_FILE		"audio-service.file"
+#define SAMPLE_PROP_LOUDNESS		"audio-service.loudness"
+#define SAMPLE_PROP_PEAK		"audio-service.peak"
+
+/* Plays counting towards automatic pinning lose half their weight every
+ * that many seconds */
+#define HOT_DECAY_PERIOD_SEC	600
+/* Automatically pinned samples take up at most this share of the budget */
+#define HOT_BUDGET_SHARE	4
+
+/* Defaults for the loudness normalization in LUFS and dBFS */
+#define DEFAULT_TARGET_LOUDNESS		-23.0
+#define DEFAULT_PEAK_CEILING		-1.0
+/* Quiet samples are not boosted by more than that many dB */
+#define MAX_NORMALIZATION_GAIN		12.0
+/* Boosts are applied to the converted file in steps of that many dB */
+#define NORMALIZATION_GAIN_STEP		0.1
+
+/* Time in milliseconds we wait for more changes of the sample files before
+ * we refresh the affected samples, updates replace many of them at once */
+#define REFRESH_DELAY_MSEC	500
+
+/* Number of samples we upload in parallel while prewarming the sample cache */
+#define PREWARM_MAX_CONCURRENT_UPLOADS	2
+
+struct prewarm_data {
+    GQueue pending;
+    unsigned int total;
+    unsigned int finished;
+    unsigned int failed;
+    unsigned int in_flight;
+};
+
+SampleCache::SampleCache(AudioService *service) :
+    mService(service),
+    mSamples(0),
+    mResidentBytes(0),
+    mBudget(0),
+    mHotPlayCount(0),
+    mHotBytes(0),
+    mNormalize(true),
+    mTargetLoudness(DEFAULT_TARGET_LOUDNESS),
+    mPeakCeiling(DEFAULT_PEAK_CEILING),
+    mDefaultCoalesceWindow(0),
+    mDefaultMaxInstances(0),
+    mDecodeCacheDir(0),
+    mHasTarget(false),
+    mPrewarm(0),
+    mPrewarmIdle(0),
+    mPrewarmRequested(false),
+    mAdopting(false),
+    mMonitor(0),
+    mChanged(0),
+    mChangedTimeout(0)
+{
+    Settings *settings = service->settings();
+    char **pinned;
+    int i;
+
+    /* keys are owned by the sample they point to */
+    mSamples = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_sample);
+    g_queue_init(&mLru);
+
+    mBudget = (size_t) MAX(settings->get_integer("SampleCache", "MemoryBudget", 0), 0) * 1024;
+    mHotPlayCount = MAX(settings->get_integer("SampleCache", "HotPlayCount", 0), 0);
+    mDecodeCacheDir = settings->get_string("SampleCache", "DecodeCacheDir", DECODE_CACHE_PATH);
+    mDefaultCoalesceWindow = settings->get_integer("Feedback", "CoalesceWindow", 0);
+    mDefaultMaxInstances = settings->get_integer("Feedback", "MaxInstances", 0);
+    mNormalize = settings->get_boolean("Feedback", "Normalize", true);
+    mTargetLoudness = settings->get_double("Feedback", "TargetLoudness", DEFAULT_TARGET_LOUDNESS);
+    mPeakCeiling = settings->get_double("Feedback", "PeakCeiling", DEFAULT_PEAK_CEILING);
+
+    pinned = settings->get_string_list("SampleCache", "PinnedSamples");
+    for (i = 0; pinned && pinned[i]; i++)
+        lookup_or_create(g_strstrip(pinned[i]))->pinned = true;
+    g_strfreev(pinned);
+
+    if (mBudget > 0)
+        g_message("Limiting feedback sample cache to %zu bytes", mBudget);
+
+    watch_samples();
+}
+
+SampleCache::~SampleCache()
+{
+    if (mChangedTimeout)
+        g_source_remove(mChangedTimeout);
+
+    if (mPrewarmIdle)
+        g_source_remove(mPrewarmIdle);
+
+    if (mMonitor) {
+        g_file_monitor_cancel(mMonitor);
+        g_object_unref(mMonitor);
+    }
+
+    if (mChanged)
+        g_hash_table_destroy(mChanged);
+
+    if (mPrewarm) {
+        while (!g_queue_is_empty(&mPrewarm->pending))
+            g_free(g_queue_pop_head(&mPrewarm->pending));
+        g_free(mPrewarm);
+    }
+
+    g_queue_clear(&mLru);
+    g_hash_table_destroy(mSamples);
+    g_free(mDecodeCacheDir);
+}
+
+void SampleCache::free_sample(gpointer data)
+{
+    Sample *sample = static_cast<Sample*>(data);
+
+    if (sample->stream) {
+        pa_stream_set_state_callback(sample->stream, NULL, NULL);
+        pa_stream_set_write_callback(sample->stream, NULL, NULL);
+        pa_stream_unref(sample->stream);
+    }
+
+    unmap_sample(sample);
+
+    g_free(sample->instance_ends);
+    delete sample;
+}
+
+Sample* SampleCache::lookup_or_create(const std::string& name)
+{
+    Settings *settings = mService->settings();
+    Sample *sample;
+    char *group, *priority;
+
+    sample = static_cast<Sample*>(g_hash_table_lookup(mSamples, name.c_str()));
+    if (sample)
+        return sample;
+
+    sample = new Sample();
+    sample->cache = this;
+    sample->name = name;
+    sample->state = SAMPLE_STATE_ABSENT;
+    sample->stream = 0;
+    sample->data = 0;
+    sample->mapped = false;
+    sample->offset = 0;
+    sample->length = 0;
+    sample->written = 0;
+    sample->play_count = 0;
+    sample->last_used = 0;
+    sample->pinned = false;
+    sample->hot = false;
+    sample->loudness = 0.0;
+    sample->peak = 0.0;
+    sample->volume = PA_VOLUME_NORM;
+    sample->lru_link = 0;
+    sample->users = 0;
+    sample->last_started = 0;
+
+    /* per sample limits live in a [Sample <name>] group */
+    group = g_strdup_printf("Sample %s", name.c_str());
+    sample->coalesce_window = (gint64) MAX(settings->get_integer(group, "CoalesceWindow",
+                                                                 mDefaultCoalesceWindow), 0) * 1000;
+    sample->max_instances = MAX(settings->get_integer(group, "MaxInstances", mDefaultMaxInstances), 0);
+    sample->instance_ends = sample->max_instances > 0 ? g_new0(gint64, sample->max_instances) : NULL;
+
+    sample->priority = FEEDBACK_PRIORITY_NORMAL;
+    priority = settings->get_string(group, "Priority", NULL);
+    if (priority && !feedback_priority_parse(priority, strlen(priority), &sample->priority))
+        g_warning("Invalid priority %s for sample %s", priority, name.c_str());
+    g_free(priority);
+
+    g_free(group);
+
+    g_hash_table_insert(mSamples, (gpointer) sample->name.c_str(), sample);
+
+    return sample;
+}
+
+void SampleCache::load(const std::string& name, SampleCacheResultCallback callback)
+{
+    Sample *sample = lookup_or_create(name);
+
+    switch (sample->state) {
+    case SAMPLE_STATE_RESIDENT:
+        callback(true);
+        return;
+    case SAMPLE_STATE_UPLOADING:
+        g_message("Waiting for upload of sample %s already in progress", name.c_str());
+        sample->waiters.push_back(callback);
+        return;
+    case SAMPLE_STATE_ABSENT:
+    case SAMPLE_STATE_FAILED:
+        /* retry failed ones as the sample might have been installed since */
+        sample->waiters.push_back(callback);
+        upload(sample);
+        return;
+    }
+}
+
+void SampleCache::finish_upload(Sample *sample, bool success)
+{
+    std::vector<SampleCacheResultCallback> waiters;
+
+    /* resident samples keep their data so they can be written to a playback
+     * stream directly, mapped ones live in the page cache and can be
+     * reclaimed anytime */
+    if (!success)
+        unmap_sample(sample);
+
+    if (sample->stream) {
+        pa_stream_set_state_callback(sample->stream, NULL, NULL);
+        pa_stream_set_write_callback(sample->stream, NULL, NULL);
+        pa_stream_unref(sample->stream);
+        sample->stream = 0;
+    }
+
+    sample->state = success ? SAMPLE_STATE_RESIDENT : SAMPLE_STATE_FAILED;
+
+    if (success) {
+        mResidentBytes += sample->length;
+        sample->last_used = g_get_monotonic_time();
+
+        g_queue_push_tail(&mLru, sample);
+        sample->lru_link = g_queue_peek_tail_link(&mLru);
+
+        enforce_budget(sample);
+    }
+
+    /* callbacks might request the sample again so don't iterate the list we
+     * would add them to */
+    waiters.swap(sample->waiters);
+
+    for (auto &callback : waiters)
+        callback(success);
+}
+
+Sample* SampleCache::lookup(const std::string& name) const
+{
+    return static_cast<Sample*>(g_hash_table_lookup(mSamples, name.c_str()));
+}
+
+/* Decides whether a new play of the sample should actually happen or be
+ * merged into one started just before. Admitted plays are accounted right
+ * away as the caller is going to play the sample. */
+bool SampleCache::admit(const std::string& name)
+{
+    Sample *sample;
+    gint64 now;
+    unsigned int n, free_slot;
+
+    sample = lookup_or_create(name);
+    now = g_get_monotonic_time();
+
+    if (sample->coalesce_window > 0 && sample->last_started > 0 &&
+        now - sample->last_started < sample->coalesce_window)
+        return false;
+
+    if (sample->max_instances > 0) {
+        free_slot = sample->max_instances;
+        for (n = 0; n < sample->max_instances; n++) {
+            if (sample->instance_ends[n] <= now) {
+                free_slot = n;
+                break;
+            }
+        }
+
+        if (free_slot == sample->max_instances)
+            return false;
+
+        /* we only know how long the sample plays once it was uploaded, before
+         * that the play does not count as a running instance */
+        if (sample->length > 0 && pa_sample_spec_valid(&sample->spec))
+            sample->instance_ends[free_slot] = now + pa_bytes_to_usec(sample->length, &sample->spec);
+    }
+
+    sample->last_started = now;
+
+    return true;
+}
+
+void SampleCache::hold(Sample *sample)
+{
+    sample->users++;
+}
+
+void SampleCache::release(Sample *sample)
+{
+    if (sample->users > 0)
+        sample->users--;
+
+    if (sample->users == 0)
+        enforce_budget(NULL);
+}
+
+const pa_channel_map* SampleCache::channel_map(const Sample *sample) const
+{
+    /* converted samples use the channel layout of the sink */
+    if (mHasTarget && sample->spec.channels == mTargetMap.channels)
+        return &mTargetMap;
+
+    return NULL;
+}
+
+void SampleCache::played(const std::string& name)
+{
+    Sample *sample;
+    gint64 now, periods;
+
+    sample = static_cast<Sample*>(g_hash_table_lookup(mSamples, name.c_str()));
+    if (!sample || sample->state != SAMPLE_STATE_RESIDENT)
+        return;
+
+    /* a sample played a lot once doesn't stay hot forever */
+    now = g_get_monotonic_time();
+    periods = (now - sample->last_used) / ((gint64) HOT_DECAY_PERIOD_SEC * G_USEC_PER_SEC);
+    sample->play_count = periods < 32 ? sample->play_count >> periods : 0;
+
+    sample->play_count++;
+    sample->last_used = now;
+
+    g_queue_unlink(&mLru, sample->lru_link);
+    g_queue_push_tail_link(&mLru, sample->lru_link);
+
+    if (sample->pinned || mHotPlayCount == 0)
+        return;
+
+    if (sample->hot && sample->play_count < mHotPlayCount) {
+        g_message("Unpinning sample %s which is no longer played frequently", sample->name.c_str());
+        unpin_hot(sample);
+    }
+    else if (!sample->hot && sample->play_count >= mHotPlayCount &&
+             (mBudget == 0 || mHotBytes + sample->length <= mBudget / HOT_BUDGET_SHARE)) {
+        g_message("Pinning frequently played sample %s", sample->name.c_str());
+        sample->hot = true;
+        mHotBytes += sample->length;
+    }
+}
+
+void SampleCache::unpin_hot(Sample *sample)
+{
+    if (!sample->hot)
+        return;
+
+    sample->hot = false;
+    mHotBytes -= sample->length;
+}
+
+void SampleCache::evict(Sample *sample)
+{
+    pa_operation *op;
+
+    g_message("Evicting sample %s (%zu bytes, played %u times)",
+              sample->name.c_str(), sample->length, sample->play_count);
+
+    op = pa_context_remove_sample(mService->context(), sample->name.c_str(), NULL, NULL);
+    if (op)
+        pa_operation_unref(op);
+
+    g_queue_delete_link(&mLru, sample->lru_link);
+    sample->lru_link = 0;
+
+    unpin_hot(sample);
+    sample->play_count = 0;
+
+    unmap_sample(sample);
+
+    mResidentBytes -= sample->length;
+    sample->state = SAMPLE_STATE_ABSENT;
+}
+
+void SampleCache::enforce_budget(Sample *keep)
+{
+    GList *link, *next;
+    Sample *sample;
+
+    if (mBudget == 0)
+        return;
+
+    for (link = mLru.head; link && mResidentBytes > mBudget; link = next) {
+        next = link->next;
+        sample = static_cast<Sample*>(link->data);
+
+        if (sample == keep || sample->pinned || sample->hot || sample->users > 0)
+            continue;
+
+        evict(sample);
+    }
+
+    /* samples pinned automatically only stay while there is room for them */
+    for (link = mLru.head; link && mResidentBytes > mBudget; link = next) {
+        next = link->next;
+        sample = static_cast<Sample*>(link->data);
+
+        if (sample == keep || !sample->hot || sample->users > 0)
+            continue;
+
+        evict(sample);
+    }
+
+    if (mResidentBytes > mBudget)
+        g_warning("Pinned samples exceed the sample cache budget (%zu of %zu bytes)",
+                  mResidentBytes, mBudget);
+}
+
+bool SampleCache::map_sample(Sample *sample, const char *path)
+{
+    size_t map_length, copied;
+    struct stat st;
+    ssize_t bread;
+    void *data;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        g_warning("Failed to open sample %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    /* the file may have changed since we looked at it, touching pages
+     * beyond its end would kill us */
+    if (fstat(fd, &st) != 0 || (gint64) sample->offset >= (gint64) st.st_size) {
+        g_warning("Sample %s is truncated", path);
+        close(fd);
+        return false;
+    }
+
+    if (sample->offset + sample->length > (size_t) st.st_size) {
+        g_warning("Sample %s is shorter than expected", path);
+        sample->length = st.st_size - sample->offset;
+        sample->length -= sample->length % pa_frame_size(&sample->spec);
+    }
+
+    if (sample->length == 0) {
+        g_warning("Sample %s is empty", path);
+        close(fd);
+        return false;
+    }
+
+    map_length = sample->offset + sample->length;
+
+    /* Only the files in our cache are mapped, they are replaced by renaming
+     * a new one over them and never change in place. The system sounds are
+     * rewritten by updates while we run and a mapping of one of them could
+     * end up beyond the end of the file, so if we couldn't store a copy in
+     * the cache we have to keep one in memory. */
+    if (!g_str_has_prefix(path, mDecodeCacheDir) || path[strlen(mDecodeCacheDir)] != '/') {
+        data = g_malloc(map_length);
+
+        for (copied = 0; copied < map_length; copied += bread) {
+            bread = pread(fd, (uint8_t*) data + copied, map_length - copied, copied);
+            if (bread <= 0)
+                break;
+        }
+
+        close(fd);
+
+        if (copied < map_length) {
+            g_warning("Failed to read sample %s", path);
+            g_free(data);
+            return false;
+        }
+
+        sample->data = static_cast<const uint8_t*>(data);
+        sample->mapped = false;
+
+        return true;
+    }
+
+    data = mmap(NULL, map_length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        g_warning("Failed to map sample %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    /* we read the whole sample once from start to end */
+    madvise(data, map_length, MADV_SEQUENTIAL);
+    madvise(data, map_length, MADV_WILLNEED);
+
+    sample->data = static_cast<const uint8_t*>(data);
+    sample->mapped = true;
+
+    return true;
+}
+
+void SampleCache::unmap_sample(Sample *sample)
+{
+    if (!sample->data)
+        return;
+
+    if (sample->mapped)
+        munmap((void*) sample->data, sample->offset + sample->length);
+    else
+        g_free((void*) sample->data);
+
+    sample->data = 0;
+}
+
+void SampleCache::upload(Sample *sample)
+{
+    char *sample_path;
+
+    g_message("Preloading sample %s", sample->name.c_str());
+
+    sample->state = SAMPLE_STATE_UPLOADING;
+    sample->written = 0;
+
+    sample_path = sample_file_find(SAMPLE_PATH, sample->name.c_str());
+    if (!sample_path) {
+        g_warning("Sample %s doesn't exist", sample->name.c_str());
+        finish_upload(sample, false);
+        return;
+    }
+
+    sample->source = sample_path;
+
+    prepare(sample, sample_path, sample_file_needs_conversion(sample_path, mHasTarget ? &mTargetSpec : NULL));
+
+    g_free(sample_path);
+}
+
+struct prepare_data {
+    char *path;
+    char *cache_dir;
+    bool convert;
+    bool has_target;
+    pa_sample_spec target;
+    bool normalize;
+    double target_loudness;
+    double peak_ceiling;
+};
+
+struct prepare_result {
+    /* file to upload, the source itself or its converted copy */
+    char *path;
+    bool measured;
+    Loudness loudness;
+};
+
+/* Gain in dB bringing a sample to the target loudness. Silence isn't
+ * amplified and the peak never pushed above the ceiling. */
+static double normalization_gain(double loudness, double peak, double target_loudness, double peak_ceiling)
+{
+    double gain;
+
+    gain = loudness > -70.0 ? target_loudness - loudness : 0.0;
+    gain = MIN(gain, MAX_NORMALIZATION_GAIN);
+
+    return MIN(gain, peak_ceiling - peak);
+}
+
+/* Reads a copy of the file rather than mapping it, the system sounds can
+ * change under us anytime */
+static bool measure_loudness(const char *path, Loudness *result)
+{
+    SampleFile file;
+    gchar *contents;
+    gsize length;
+    bool success;
+
+    if (!sample_file_open(path, &file) || !g_file_get_contents(path, &contents, &length, NULL))
+        return false;
+
+    success = file.offset + file.length <= length &&
+              loudness_analyze((const guint8*) contents + file.offset, file.length, &file.spec, result);
+
+    g_free(contents);
+
+    return success;
+}
+
+/* Decoding compressed samples, converting them to the format of the sink and
+ * measuring their loudness takes a while so it's done on a worker thread.
+ * Converted samples end up in the on-disk cache from where we upload them
+ * just like any other sample. */
+void SampleCache::prepare(Sample *sample, const char *path, bool needs_conversion)
+{
+    struct prepare_data *data;
+    GTask *task;
+
+    if (needs_conversion)
+        g_message("Converting sample %s from %s", sample->name.c_str(), path);
+
+    data = g_new0(struct prepare_data, 1);
+    data->path = g_strdup(path);
+    data->cache_dir = g_strdup(mDecodeCacheDir);
+    data->convert = needs_conversion;
+    data->has_target = mHasTarget;
+    data->target = mTargetSpec;
+    data->normalize = mNormalize;
+    data->target_loudness = mTargetLoudness;
+    data->peak_ceiling = mPeakCeiling;
+
+    task = g_task_new(NULL, NULL, [](GObject *source, GAsyncResult *result, gpointer user_data) {
+        Sample *sample = static_cast<Sample*>(user_data);
+        struct prepare_result *prepared;
+        GError *error = NULL;
+
+        prepared = (struct prepare_result*) g_task_propagate_pointer(G_TASK(result), &error);
+        if (!prepared) {
+            g_warning("Failed to convert sample %s: %s", sample->name.c_str(), error->message);
+            g_error_free(error);
+            sample->cache->finish_upload(sample, false);
+            return;
+        }
+
+        if (prepared->measured) {
+            sample->loudness = prepared->loudness.integrated;
+            sample->peak = prepared->loudness.peak;
+        }
+        else {
+            g_message("Can't measure loudness of sample %s", sample->name.c_str());
+            sample->loudness = sample->cache->mTargetLoudness;
+            sample->peak = sample->cache->mPeakCeiling;
+        }
+
+        sample->cache->start_upload(sample, prepared->path);
+
+        g_free(prepared->path);
+        g_free(prepared);
+    }, sample);
+
+    g_task_set_task_data(task, data, [](gpointer user_data) {
+        struct prepare_data *data = (struct prepare_data*) user_data;
+        g_free(data->path);
+        g_free(data->cache_dir);
+        g_free(data);
+    });
+
+    g_task_run_in_thread(task, [](GTask *task, gpointer source, gpointer task_data, GCancellable *cancellable) {
+        struct prepare_data *data = (struct prepare_data*) task_data;
+        struct prepare_result *prepared;
+        GError *error = NULL;
+        char *path, *boosted_path;
+        double gain;
+
+        if (data->convert) {
+            path = sample_file_convert(data->path, data->has_target ? &data->target : NULL, 0.0,
+                                       data->cache_dir, &error);
+            if (!path) {
+                g_task_return_error(task, error);
+                return;
+            }
+        }
+        else {
+            /* system sounds are only ever mapped through a copy of our own */
+            path = sample_file_copy(data->path, data->cache_dir, &error);
+            if (!path) {
+                g_warning("Failed to copy sample %s: %s", data->path, error->message);
+                g_clear_error(&error);
+                path = g_strdup(data->path);
+            }
+        }
+
+        prepared = g_new0(struct prepare_result, 1);
+        prepared->path = path;
+        prepared->measured = measure_loudness(path, &prepared->loudness);
+
+        /* A sink input louder than its sink raises the volume of the sink
+         * and with it of everything else playing, so quiet samples are
+         * boosted in a converted copy and only ever attenuated when played */
+        if (data->normalize && prepared->measured) {
+            gain = normalization_gain(prepared->loudness.integrated, prepared->loudness.peak,
+                                      data->target_loudness, data->peak_ceiling);
+            gain = floor(gain / NORMALIZATION_GAIN_STEP) * NORMALIZATION_GAIN_STEP;
+
+            if (gain >= NORMALIZATION_GAIN_STEP) {
+                boosted_path = sample_file_convert(data->path, data->has_target ? &data->target : NULL, gain,
+                                                   data->cache_dir, &error);
+                if (boosted_path) {
+                    g_free(prepared->path);
+                    prepared->path = boosted_path;
+                    prepared->loudness.integrated += gain;
+                    prepared->loudness.peak += gain;
+                }
+                else {
+                    g_warning("Failed to boost sample %s: %s", data->path, error->message);
+                    g_error_free(error);
+                }
+            }
+        }
+
+        g_task_return_pointer(task, prepared, [](gpointer user_data) {
+            struct prepare_result *prepared = (struct prepare_result*) user_data;
+            g_free(prepared->path);
+            g_free(prepared);
+        });
+    });
+
+    g_object_unref(task);
+}
+
+pa_proplist* SampleCache::upload_proplist(Sample *sample, const char *path)
+{
+    pa_proplist *proplist;
+    struct stat st;
+    char buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+    proplist = pa_proplist_new();
+
+    if (stat(sample->source.c_str(), &st) == 0) {
+        pa_proplist_sets(proplist, SAMPLE_PROP_SOURCE, sample->source.c_str());
+        pa_proplist_setf(proplist, SAMPLE_PROP_SOURCE_SIZE, "%" G_GINT64_FORMAT, (gint64) st.st_size);
+        pa_proplist_setf(proplist, SAMPLE_PROP_SOURCE_MTIME, "%" G_GINT64_FORMAT, (gint64) st.st_mtime);
+        pa_proplist_sets(proplist, SAMPLE_PROP_FILE, path);
+        pa_proplist_sets(proplist, SAMPLE_PROP_LOUDNESS,
+                         g_ascii_dtostr(buffer, sizeof(buffer), sample->loudness));
+        pa_proplist_sets(proplist, SAMPLE_PROP_PEAK,
+                         g_ascii_dtostr(buffer, sizeof(buffer), sample->peak));
+    }
+
+    return proplist;
+}
+
+/* Works out the gain the sample is played with so all feedback sounds end up
+ * equally loud. The loudness is measured while preparing the upload and
+ * travels with the sample in pulseaudio, so samples taken over after a
+ * restart don't need another measurement. */
+void SampleCache::normalize(Sample *sample)
+{
+    double gain;
+
+    sample->volume = PA_VOLUME_NORM;
+
+    if (!mNormalize)
+        return;
+
+    /* boosts are already part of the data we upload */
+    gain = normalization_gain(sample->loudness, sample->peak, mTargetLoudness, mPeakCeiling);
+    gain = MIN(gain, 0.0);
+
+    sample->volume = pa_sw_volume_from_dB(gain);
+
+    g_message("Sample %s: loudness %.1f LUFS, peak %.1f dBFS, playing with %+.1f dB",
+              sample->name.c_str(), sample->loudness, sample->peak, gain);
+}
+
+void SampleCache::start_upload(Sample *sample, const char *path)
+{
+    pa_proplist *proplist;
+    SampleFile file;
+
+    if (!sample_file_open(path, &file)) {
+        g_warning("Sample %s has an unsupported format", path);
+        finish_upload(sample, false);
+        return;
+    }
+
+    sample->spec = file.spec;
+    sample->offset = file.offset;
+    sample->length = file.length;
+
+    if (!map_sample(sample, path)) {
+        finish_upload(sample, false);
+        return;
+    }
+
+    normalize(sample);
+
+    proplist = upload_proplist(sample, path);
+    sample->stream = pa_stream_new_with_proplist(mService->context(), sample->name.c_str(), &sample->spec,
+                                                 channel_map(sample), proplist);
+    pa_proplist_free(proplist);
+
+    if (!sample->stream) {
+        finish_upload(sample, false);
+        return;
+    }
+
+    pa_stream_set_state_callback(sample->stream, [](pa_stream *stream, void *user_data) {
+        Sample *sample = static_cast<Sample*>(user_data);
+
+        switch (pa_stream_get_state(stream)) {
+        case PA_STREAM_CREATING:
+        case PA_STREAM_READY:
+            return;
+        case PA_STREAM_TERMINATED:
+            /* we disconnect ourself when writing the sample failed */
+            if (sample->written == sample->length) {
+                g_message("Successfully uploaded sample %s to pulseaudio", sample->name.c_str());
+                sample->cache->finish_upload(sample, true);
+                break;
+            }
+            /* fall through */
+        case PA_STREAM_FAILED:
+        default:
+            g_warning("Failed to upload sample %s", sample->name.c_str());
+            sample->cache->finish_upload(sample, false);
+            break;
+        }
+    }, sample);
+
+    /* Copy exactly as much as pulseaudio asks for straight from the sample data
+     * into the memory handed out by pa_stream_begin_write. Those blocks come
+     * from the shared memory pool of the connection (memfd or posix shm for
+     * local connections) so the daemon picks them up without another copy. */
+    pa_stream_set_write_callback(sample->stream, [](pa_stream *stream, size_t length, void *user_data) {
+        Sample *sample = static_cast<Sample*>(user_data);
+        void *buffer;
+        size_t chunk;
+
+        while (length > 0 && sample->written < sample->length) {
+            chunk = MIN(length, sample->length - sample->written);
+
+            if (pa_stream_begin_write(stream, &buffer, &chunk) < 0 || !buffer) {
+                g_warning("Failed to get upload buffer for sample %s", sample->name.c_str());
+                pa_stream_set_write_callback(stream, NULL, NULL);
+                pa_stream_disconnect(stream);
+                return;
+            }
+
+            /* the buffer we got might be larger than what we asked for */
+            chunk = MIN(chunk, MIN(length, sample->length - sample->written));
+
+            memcpy(buffer, sample->data + sample->offset + sample->written, chunk);
+            pa_stream_write(stream, buffer, chunk, NULL, 0, PA_SEEK_RELATIVE);
+
+            sample->written += chunk;
+            length -= chunk;
+        }
+
+        if (sample->written == sample->length) {
+            pa_stream_set_write_callback(stream, NULL, NULL);
+            pa_stream_finish_upload(stream);
+        }
+    }, sample);
+
+    if (pa_stream_connect_upload(sample->stream, sample->length) < 0) {
+        g_warning("Failed to start upload of sample %s", sample->name.c_str());
+        finish_upload(sample, false);
+    }
+}
+
+gboolean SampleCache::prewarm_continue_cb(gpointer user_data)
+{
+    SampleCache *cache = static_cast<SampleCache*>(user_data);
+
+    cache->mPrewarmIdle = 0;
+    cache->prewarm_start_uploads();
+
+    return FALSE;
+}
+
+void SampleCache::prewarm_start_uploads()
+{
+    char *name;
+
+    if (!mPrewarm)
+        return;
+
+    /* don't push out samples which are actually used just to make room
+     * for ones which might be */
+    if (mBudget > 0 && mResidentBytes >= mBudget && !g_queue_is_empty(&mPrewarm->pending)) {
+        g_message("Sample cache budget reached, not prewarming remaining %u samples",
+                  g_queue_get_length(&mPrewarm->pending));
+        while (!g_queue_is_empty(&mPrewarm->pending))
+            g_free(g_queue_pop_head(&mPrewarm->pending));
+    }
+
+    while (mPrewarm->in_flight < PREWARM_MAX_CONCURRENT_UPLOADS &&
+           !g_queue_is_empty(&mPrewarm->pending)) {
+        name = (char*) g_queue_pop_head(&mPrewarm->pending);
+
+        mPrewarm->in_flight++;
+
+        load(name, [this](bool success) {
+            mPrewarm->in_flight--;
+            mPrewarm->finished++;
+            if (!success)
+                mPrewarm->failed++;
+
+            g_message("Prewarmed %u of %u samples (%u failed)",
+                      mPrewarm->finished, mPrewarm->total, mPrewarm->failed);
+
+            /* start the next upload with the next mainloop iteration so we
+             * don't produce one long burst of work on the mainloop */
+            if (!mPrewarmIdle)
+                mPrewarmIdle = g_idle_add(prewarm_continue_cb, this);
+        });
+
+        g_free(name);
+    }
+
+    if (mPrewarm->in_flight == 0 && g_queue_is_empty(&mPrewarm->pending)) {
+        g_message("Finished prewarming sample cache");
+        g_free(mPrewarm);
+        mPrewarm = 0;
+    }
+}
+
+void SampleCache::set_target_format(const pa_sample_spec *spec, const pa_channel_map *map)
+{
+    if (mHasTarget && pa_sample_spec_equal(&mTargetSpec, spec) && pa_channel_map_equal(&mTargetMap, map))
+        return;
+
+    /* samples uploaded before stay in the format they have, pulseaudio
+     * still converts them while playing */
+    g_message("Preparing feedback samples for %s %uHz %u channels",
+              pa_sample_format_to_string(spec->format), spec->rate, spec->channels);
+
+    mTargetSpec = *spec;
+    mTargetMap = *map;
+    mHasTarget = true;
+
+    if (mPrewarmRequested) {
+        mPrewarmRequested = false;
+        prewarm();
+    }
+}
+
+/* After a restart of the service pulseaudio still has all samples we
+ * uploaded before. Take over those which still match their file instead of
+ * uploading them again. */
+void SampleCache::adopt_resident_samples()
+{
+    pa_operation *op;
+
+    op = pa_context_get_sample_info_list(mService->context(),
+                                         [](pa_context *context, const pa_sample_info *info, int eol, void *user_data) {
+        SampleCache *cache = static_cast<SampleCache*>(user_data);
+
+        if (eol) {
+            g_message("Reusing %u samples already known to pulseaudio", g_queue_get_length(&cache->mLru));
+
+            cache->mAdopting = false;
+            cache->enforce_budget(NULL);
+
+            if (cache->mPrewarmRequested) {
+                cache->mPrewarmRequested = false;
+                cache->prewarm();
+            }
+            return;
+        }
+
+        cache->adopt(info);
+    }, this);
+
+    if (!op) {
+        g_warning("Failed to query samples known to pulseaudio");
+        return;
+    }
+
+    mAdopting = true;
+    pa_operation_unref(op);
+}
+
+void SampleCache::adopt(const pa_sample_info *info)
+{
+    const char *source, *path, *value, *loudness, *peak;
+    char *current_source;
+    Sample *sample;
+    SampleFile file;
+    struct stat st;
+    bool stale = true;
+    pa_operation *op;
+
+    /* only touch samples we uploaded ourself */
+    source = pa_proplist_gets(info->proplist, SAMPLE_PROP_SOURCE);
+    path = pa_proplist_gets(info->proplist, SAMPLE_PROP_FILE);
+    if (!source || !path)
+        return;
+
+    sample = lookup_or_create(info->name);
+    if (sample->state != SAMPLE_STATE_ABSENT)
+        return;
+
+    /* The sample is still good if its source is the file we would pick now
+     * and did not change since, the file uploaded from is still there and we
+     * know its loudness */
+    current_source = sample_file_find(SAMPLE_PATH, info->name);
+
+    if (current_source && g_strcmp0(current_source, source) == 0 &&
+        stat(source, &st) == 0 &&
+        (value = pa_proplist_gets(info->proplist, SAMPLE_PROP_SOURCE_SIZE)) &&
+        g_ascii_strtoll(value, NULL, 10) == (gint64) st.st_size &&
+        (value = pa_proplist_gets(info->proplist, SAMPLE_PROP_SOURCE_MTIME)) &&
+        g_ascii_strtoll(value, NULL, 10) == (gint64) st.st_mtime &&
+        sample_file_open(path, &file) &&
+        pa_sample_spec_equal(&file.spec, &info->sample_spec) &&
+        file.length == info->bytes &&
+        (loudness = pa_proplist_gets(info->proplist, SAMPLE_PROP_LOUDNESS)) &&
+        (peak = pa_proplist_gets(info->proplist, SAMPLE_PROP_PEAK)))
+        stale = false;
+
+    g_free(current_source);
+
+    if (stale) {
+        g_message("Removing outdated sample %s from pulseaudio", info->name);
+
+        op = pa_context_remove_sample(mService->context(), info->name, NULL, NULL);
+        if (op)
+            pa_operation_unref(op);
+        return;
+    }
+
+    sample->source = source;
+    sample->spec = file.spec;
+    sample->offset = file.offset;
+    sample->length = file.length;
+    sample->loudness = g_ascii_strtod(loudness, NULL);
+    sample->peak = g_ascii_strtod(peak, NULL);
+
+    /* we need the data for playing the sample through our own streams */
+    if (!map_sample(sample, path))
+        return;
+
+    normalize(sample);
+
+    finish_upload(sample, true);
+}
+
+void SampleCache::prewarm()
+{
+    GDir *dir;
+    GError *error = NULL;
+    GHashTable *seen;
+    const char *filename;
+
+    if (mPrewarm) {
+        g_message("Sample cache prewarming already in progress");
+        return;
+    }
+
+    /* wait until we know which format to convert the samples to and what
+     * pulseaudio still has from before */
+    if (!mHasTarget || mAdopting) {
+        mPrewarmRequested = true;
+        return;
+    }
+
+    dir = g_dir_open(SAMPLE_PATH, 0, &error);
+    if (!dir) {
+        g_warning("Failed to list samples for prewarming: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    mPrewarm = g_new0(struct prewarm_data, 1);
+    g_queue_init(&mPrewarm->pending);
+
+    /* the same sample might be available in more than one format */
+    seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    while ((filename = g_dir_read_name(dir)) != NULL) {
+        Sample *sample;
+        char *name;
+
+        name = sample_file_strip_suffix(filename);
+        if (!name)
+            continue;
+
+        if (g_hash_table_contains(seen, name)) {
+            g_free(name);
+            continue;
+        }
+
+        g_hash_table_insert(seen, g_strdup(name), NULL);
+
+        /* pinned samples go first so they make it into the budget */
+        sample = static_cast<Sample*>(g_hash_table_lookup(mSamples, name));
+        if (sample && sample->pinned)
+            g_queue_push_head(&mPrewarm->pending, name);
+        else
+            g_queue_push_tail(&mPrewarm->pending, name);
+
+        mPrewarm->total++;
+    }
+
+    g_hash_table_destroy(seen);
+
+    g_dir_close(dir);
+
+    g_message("Prewarming sample cache with %u samples", mPrewarm->total);
+
+    prewarm_start_uploads();
+}
+
+/* Theme and system updates replace the sample files while we're running so
+ * watch them and refresh only the samples which actually changed. */
+void SampleCache::watch_samples()
+{
+    GFile *directory;
+    GError *error = NULL;
+
+    mChanged = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    directory = g_file_new_for_path(SAMPLE_PATH);
+    mMonitor = g_file_monitor_directory(directory, G_FILE_MONITOR_NONE, NULL, &error);
+    g_object_unref(directory);
+
+    if (!mMonitor) {
+        g_warning("Failed to watch %s for changed samples: %s", SAMPLE_PATH, error->message);
+        g_error_free(error);
+        return;
+    }
+
+    g_signal_connect(mMonitor, "changed", G_CALLBACK(samples_changed_cb), this);
+}
+
+void SampleCache::samples_changed_cb(GFileMonitor *monitor, GFile *file, GFile *other_file,
+                                     GFileMonitorEvent event, gpointer user_data)
+{
+    SampleCache *cache = static_cast<SampleCache*>(user_data);
+    char *filename, *name;
+
+    switch (event) {
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+        break;
+    default:
+        return;
+    }
+
+    filename = g_file_get_basename(file);
+    name = sample_file_strip_suffix(filename);
+    g_free(filename);
+
+    if (!name)
+        return;
+
+    g_hash_table_replace(cache->mChanged, name, NULL);
+
+    /* wait for the rest of an update before touching anything */
+    if (cache->mChangedTimeout)
+        g_source_remove(cache->mChangedTimeout);
+    cache->mChangedTimeout = g_timeout_add(REFRESH_DELAY_MSEC, refresh_changed_cb, cache);
+}
+
+gboolean SampleCache::refresh_changed_cb(gpointer user_data)
+{
+    SampleCache *cache = static_cast<SampleCache*>(user_data);
+    GHashTable *changed;
+    GHashTableIter iter;
+    gpointer key;
+
+    cache->mChangedTimeout = 0;
+
+    /* nothing uploaded yet, prewarming takes care of all of them once the
+     * connection is up */
+    if (!cache->mService->context() ||
+        pa_context_get_state(cache->mService->context()) != PA_CONTEXT_READY) {
+        g_hash_table_remove_all(cache->mChanged);
+        return FALSE;
+    }
+
+    /* samples which can't be refreshed right now get queued again */
+    changed = cache->mChanged;
+    cache->mChanged = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    g_hash_table_iter_init(&iter, changed);
+    while (g_hash_table_iter_next(&iter, &key, NULL))
+        cache->refresh(static_cast<const char*>(key));
+
+    g_hash_table_destroy(changed);
+
+    if (g_hash_table_size(cache->mChanged) > 0)
+        cache->mChangedTimeout = g_timeout_add(REFRESH_DELAY_MSEC, refresh_changed_cb, cache);
+
+    return FALSE;
+}
+
+void SampleCache::refresh(const char *name)
+{
+    Sample *sample;
+    char *path;
+
+    sample = static_cast<Sample*>(g_hash_table_lookup(mSamples, name));
+
+    /* an upload in flight or a sequence still writing the old data, try
+     * again later */
+    if (sample && (sample->state == SAMPLE_STATE_UPLOADING || sample->users > 0)) {
+        g_hash_table_replace(mChanged, g_strdup(name), NULL);
+        return;
+    }
+
+    path = sample_file_find(SAMPLE_PATH, name);
+
+    if (sample && sample->state == SAMPLE_STATE_RESIDENT) {
+        g_message("Sample %s %s", name, path ? "changed, uploading it again" : "was removed");
+        evict(sample);
+    }
+    else if (sample && sample->state == SAMPLE_STATE_FAILED) {
+        /* might work now, the next play retries it anyway */
+        sample->state = SAMPLE_STATE_ABSENT;
+    }
+
+    /* bring changed and new samples in like prewarming does as long as they
+     * fit into the budget, everything else is loaded when played */
+    if (path && (mBudget == 0 || mResidentBytes < mBudget)) {
+        load(name, [](bool success) { });
+    }
+
+    g_free(path);
+}
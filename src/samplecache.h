@@ -0,0 +1,164 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef SAMPLECACHE_H
+#define SAMPLECACHE_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdint.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <pulse/pulseaudio.h>
+
+#include "feedbackscheduler.h"
+
+typedef std::function<void(bool)> SampleCacheResultCallback;
+
+class AudioService;
+
+enum SampleState {
+    SAMPLE_STATE_ABSENT,
+    SAMPLE_STATE_UPLOADING,
+    SAMPLE_STATE_RESIDENT,
+    SAMPLE_STATE_FAILED
+};
+
+class SampleCache;
+
+struct Sample
+{
+    SampleCache *cache;
+    std::string name;
+    SampleState state;
+
+    /* file in the systemsounds directory the sample was loaded from */
+    std::string source;
+
+    /* everyone waiting for the upload currently in flight */
+    std::vector<SampleCacheResultCallback> waiters;
+
+    pa_stream *stream;
+    pa_sample_spec spec;
+    /* mapped from our own converted file or a copy of a system sound */
+    const uint8_t *data;
+    bool mapped;
+    size_t offset;
+    size_t length;
+    size_t written;
+
+    /* usage tracking for the eviction of cold samples, hot samples are
+     * pinned automatically for as long as there is room for them */
+    unsigned int play_count;
+    gint64 last_used;
+    bool pinned;
+    bool hot;
+    GList *lru_link;
+
+    /* measured while preloading, quiet samples are boosted in the file we
+     * upload and loud ones played with a volume below PA_VOLUME_NORM */
+    double loudness;
+    double peak;
+    pa_volume_t volume;
+
+    /* users writing the data themselves, keeps it from being evicted */
+    unsigned int users;
+
+    /* rate limiting of bursts of plays of the same sample */
+    gint64 coalesce_window;
+    gint64 last_started;
+    unsigned int max_instances;
+    gint64 *instance_ends;
+    FeedbackPriority priority;
+};
+
+class SampleCache
+{
+public:
+    explicit SampleCache(AudioService *service);
+    ~SampleCache();
+
+    void load(const std::string& name, SampleCacheResultCallback callback);
+    Sample* lookup(const std::string& name) const;
+    bool admit(const std::string& name);
+    void hold(Sample *sample);
+    void release(Sample *sample);
+    const pa_channel_map* channel_map(const Sample *sample) const;
+    void played(const std::string& name);
+    void adopt_resident_samples();
+    void prewarm();
+    void set_target_format(const pa_sample_spec *spec, const pa_channel_map *map);
+
+private:
+    AudioService *mService;
+    GHashTable *mSamples;
+
+    /* resident samples, least recently used first */
+    GQueue mLru;
+    size_t mResidentBytes;
+    size_t mBudget;
+    unsigned int mHotPlayCount;
+    size_t mHotBytes;
+    bool mNormalize;
+    double mTargetLoudness;
+    double mPeakCeiling;
+    int mDefaultCoalesceWindow;
+    int mDefaultMaxInstances;
+    char *mDecodeCacheDir;
+
+    /* format of the sink we convert samples to while preloading them */
+    bool mHasTarget;
+    pa_sample_spec mTargetSpec;
+    pa_channel_map mTargetMap;
+
+    struct prewarm_data *mPrewarm;
+    guint mPrewarmIdle;
+    bool mPrewarmRequested;
+    bool mAdopting;
+
+    /* samples whose files changed, handled together once things settled */
+    GFileMonitor *mMonitor;
+    GHashTable *mChanged;
+    guint mChangedTimeout;
+
+    Sample* lookup_or_create(const std::string& name);
+    void upload(Sample *sample);
+    void prepare(Sample *sample, const char *path, bool needs_conversion);
+    void start_upload(Sample *sample, const char *path);
+    void finish_upload(Sample *sample, bool success);
+    bool map_sample(Sample *sample, const char *path);
+    void evict(Sample *sample);
+    void unpin_hot(Sample *sample);
+    void enforce_budget(Sample *keep);
+    void prewarm_start_uploads();
+    void adopt(const pa_sample_info *info);
+    pa_proplist* upload_proplist(Sample *sample, const char *path);
+    void normalize(Sample *sample);
+    void watch_samples();
+    void refresh(const char *name);
+
+    static void unmap_sample(Sample *sample);
+    static void free_sample(gpointer data);
+    static gboolean prewarm_continue_cb(gpointer user_data);
+    static void samples_changed_cb(GFileMonitor *monitor, GFile *file, GFile *other_file,
+                                   GFileMonitorEvent event, gpointer user_data);
+    static gboolean refresh_changed_cb(gpointer user_data);
+};
+
+#endif // SAMPLECACHE_H
@@ -0,0 +1,742 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <stdio.h>
+#include <math.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <gio/gio.h>
+
+#ifdef HAVE_SNDFILE
+#include <sndfile.h>
+#endif
+
+#include "samplefile.h"
+#include "resampler.h"
+
+#define WAV_HEADER_LENGTH	44
+#define WAV_FORMAT_PCM		0x0001
+#define WAV_FORMAT_FLOAT	0x0003
+#define WAV_FORMAT_EXTENSIBLE	0xfffe
+
+#define DECODE_CHUNK_FRAMES	4096
+#define HASH_CHUNK_SIZE		65536
+#define HASH_LENGTH		40
+
+/* Raw samples without any header are what we always supported so they
+ * still come first and keep their fixed format. */
+static const char *sample_suffixes[] = {
+    ".pcm",
+    ".wav",
+    ".flac",
+    ".ogg",
+    ".opus",
+    NULL
+};
+
+char* sample_file_strip_suffix(const char *filename)
+{
+    int i;
+
+    for (i = 0; sample_suffixes[i]; i++) {
+        if (g_str_has_suffix(filename, sample_suffixes[i]))
+            return g_strndup(filename, strlen(filename) - strlen(sample_suffixes[i]));
+    }
+
+    return NULL;
+}
+
+char* sample_file_find(const char *directory, const char *name)
+{
+    char *path;
+    int i;
+
+    for (i = 0; sample_suffixes[i]; i++) {
+        path = g_strdup_printf("%s/%s%s", directory, name, sample_suffixes[i]);
+        if (g_file_test(path, G_FILE_TEST_IS_REGULAR))
+            return path;
+        g_free(path);
+    }
+
+    return NULL;
+}
+
+static guint16 read_le16(const guint8 *data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+static guint32 read_le32(const guint8 *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((guint32) data[3] << 24);
+}
+
+static bool wav_format_to_sample_format(guint16 format, guint16 bits, pa_sample_format_t *result)
+{
+    if (format == WAV_FORMAT_PCM) {
+        switch (bits) {
+        case 8:
+            *result = PA_SAMPLE_U8;
+            return true;
+        case 16:
+            *result = PA_SAMPLE_S16LE;
+            return true;
+        case 24:
+            *result = PA_SAMPLE_S24LE;
+            return true;
+        case 32:
+            *result = PA_SAMPLE_S32LE;
+            return true;
+        }
+    }
+    else if (format == WAV_FORMAT_FLOAT && bits == 32) {
+        *result = PA_SAMPLE_FLOAT32LE;
+        return true;
+    }
+
+    return false;
+}
+
+static bool sample_file_parse_wav(const char *path, SampleFile *file)
+{
+    FILE *fp;
+    guint8 header[12], chunk[8], fmt[40];
+    guint32 chunk_length;
+    guint16 format = 0, bits = 0;
+    bool have_format = false;
+    long position;
+    struct stat st;
+    size_t length;
+
+    fp = fopen(path, "rb");
+    if (!fp)
+        return false;
+
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+        memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+        goto error;
+
+    while (fread(chunk, 1, sizeof(chunk), fp) == sizeof(chunk)) {
+        chunk_length = read_le32(chunk + 4);
+        position = ftell(fp);
+
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            if (chunk_length < 16 ||
+                fread(fmt, 1, MIN(chunk_length, sizeof(fmt)), fp) != MIN(chunk_length, sizeof(fmt)))
+                goto error;
+
+            format = read_le16(fmt);
+            file->spec.channels = read_le16(fmt + 2);
+            file->spec.rate = read_le32(fmt + 4);
+            bits = read_le16(fmt + 14);
+
+            /* the actual format is the first part of the sub format GUID */
+            if (format == WAV_FORMAT_EXTENSIBLE && chunk_length >= 26)
+                format = read_le16(fmt + 24);
+
+            have_format = true;
+        }
+        else if (memcmp(chunk, "data", 4) == 0) {
+            if (!have_format || !wav_format_to_sample_format(format, bits, &file->spec.format) ||
+                !pa_sample_spec_valid(&file->spec))
+                goto error;
+
+            /* Truncated files and those of streaming writers which leave the
+             * length open claim more data than there is, only take what the
+             * file actually has */
+            if (fstat(fileno(fp), &st) != 0 || st.st_size <= position)
+                goto error;
+
+            length = MIN((guint64) chunk_length, (guint64) (st.st_size - position));
+            length -= length % pa_frame_size(&file->spec);
+            if (length == 0)
+                goto error;
+
+            file->offset = position;
+            file->length = length;
+
+            fclose(fp);
+
+            return true;
+        }
+
+        /* chunks are padded to an even length */
+        if (fseek(fp, position + chunk_length + (chunk_length & 1), SEEK_SET) != 0)
+            goto error;
+    }
+
+error:
+    fclose(fp);
+    return false;
+}
+
+bool sample_file_open(const char *path, SampleFile *file)
+{
+    struct stat st;
+
+    if (g_str_has_suffix(path, ".pcm")) {
+        if (stat(path, &st) != 0)
+            return false;
+
+        file->spec.format = PA_SAMPLE_S16LE;
+        file->spec.rate = 44100;
+        file->spec.channels = 1;
+        file->offset = 0;
+        file->length = st.st_size;
+
+        return true;
+    }
+
+    return sample_file_parse_wav(path, file);
+}
+
+static void write_le16(guint8 *data, guint16 value)
+{
+    data[0] = value & 0xff;
+    data[1] = (value >> 8) & 0xff;
+}
+
+static void write_le32(guint8 *data, guint32 value)
+{
+    data[0] = value & 0xff;
+    data[1] = (value >> 8) & 0xff;
+    data[2] = (value >> 16) & 0xff;
+    data[3] = (value >> 24) & 0xff;
+}
+
+/* Samples are converted to the rate and channels of the target but we only
+ * ever store them as S16LE or, if that's what the target uses, float. */
+void sample_file_converted_spec(const pa_sample_spec *target, pa_sample_spec *spec)
+{
+    spec->format = target->format == PA_SAMPLE_FLOAT32LE ? PA_SAMPLE_FLOAT32LE : PA_SAMPLE_S16LE;
+    spec->rate = target->rate;
+    spec->channels = target->channels;
+}
+
+bool sample_file_needs_conversion(const char *path, const pa_sample_spec *target)
+{
+    SampleFile file;
+
+    /* anything we can't upload as it is needs decoding */
+    if (!sample_file_open(path, &file))
+        return true;
+
+    if (!target)
+        return false;
+
+    return file.spec.rate != target->rate ||
+           file.spec.channels != target->channels ||
+           (file.spec.format != PA_SAMPLE_S16LE && file.spec.format != target->format);
+}
+
+static char* sample_file_compute_hash(const char *path, GError **error)
+{
+    GChecksum *checksum;
+    FILE *fp;
+    guint8 *buffer;
+    size_t bread;
+    char *hash;
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    buffer = (guint8*) g_malloc(HASH_CHUNK_SIZE);
+
+    while ((bread = fread(buffer, 1, HASH_CHUNK_SIZE, fp)) > 0)
+        g_checksum_update(checksum, buffer, bread);
+
+    hash = g_strdup(g_checksum_get_string(checksum));
+
+    g_free(buffer);
+    g_checksum_free(checksum);
+    fclose(fp);
+
+    return hash;
+}
+
+static float pcm_to_float(const guint8 *data, pa_sample_format_t format)
+{
+    gint32 value;
+    union {
+        guint32 u;
+        float f;
+    } converted;
+
+    switch (format) {
+    case PA_SAMPLE_U8:
+        return (data[0] - 128) / 128.0f;
+    case PA_SAMPLE_S16LE:
+        return (gint16) read_le16(data) / 32768.0f;
+    case PA_SAMPLE_S24LE:
+        value = (gint32) ((guint32) data[0] << 8 | (guint32) data[1] << 16 | (guint32) data[2] << 24);
+        return (value >> 8) / 8388608.0f;
+    case PA_SAMPLE_S32LE:
+        return (gint32) read_le32(data) / 2147483648.0f;
+    case PA_SAMPLE_FLOAT32LE:
+        converted.u = read_le32(data);
+        return converted.f;
+    default:
+        return 0.0f;
+    }
+}
+
+void sample_file_decode(const guint8 *data, size_t samples, pa_sample_format_t format, float *output)
+{
+    size_t sample_size = pa_sample_size_of_format(format);
+    size_t n;
+
+    for (n = 0; n < samples; n++)
+        output[n] = pcm_to_float(data + n * sample_size, format);
+}
+
+/* Only reads the header to tell the format of the sample */
+static bool sample_file_read_spec(const char *path, pa_sample_spec *spec, GError **error)
+{
+    SampleFile file;
+
+    if (sample_file_open(path, &file)) {
+        *spec = file.spec;
+        return true;
+    }
+
+#ifdef HAVE_SNDFILE
+    SNDFILE *sf;
+    SF_INFO info;
+
+    memset(&info, 0, sizeof(info));
+
+    sf = sf_open(path, SFM_READ, &info);
+    if (!sf) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to open %s: %s", path, sf_strerror(NULL));
+        return false;
+    }
+
+    sf_close(sf);
+
+    spec->format = PA_SAMPLE_FLOAT32LE;
+    spec->rate = info.samplerate;
+    spec->channels = info.channels;
+
+    if (!pa_sample_spec_valid(spec)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Unsupported sample format in %s", path);
+        return false;
+    }
+
+    return true;
+#else
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                "Can't decode %s, built without support for compressed samples", path);
+    return false;
+#endif
+}
+
+/* Reads the whole sample as interleaved float data */
+static float* sample_file_read_float(const char *path, pa_sample_spec *spec, size_t *frames, GError **error)
+{
+    SampleFile file;
+    GMappedFile *mapped;
+    const guint8 *data;
+    size_t sample_size, samples;
+    float *result;
+
+    if (sample_file_open(path, &file)) {
+        mapped = g_mapped_file_new(path, FALSE, error);
+        if (!mapped)
+            return NULL;
+
+        if (g_mapped_file_get_length(mapped) < file.offset + file.length) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Sample %s is truncated", path);
+            g_mapped_file_unref(mapped);
+            return NULL;
+        }
+
+        data = (const guint8*) g_mapped_file_get_contents(mapped) + file.offset;
+        sample_size = pa_sample_size(&file.spec);
+        samples = file.length / sample_size;
+
+        result = g_new(float, samples);
+        sample_file_decode(data, samples, file.spec.format, result);
+
+        g_mapped_file_unref(mapped);
+
+        *spec = file.spec;
+        *frames = samples / file.spec.channels;
+
+        return result;
+    }
+
+#ifdef HAVE_SNDFILE
+    SNDFILE *sf;
+    SF_INFO info;
+    GArray *buffer;
+    sf_count_t read;
+
+    memset(&info, 0, sizeof(info));
+
+    sf = sf_open(path, SFM_READ, &info);
+    if (!sf) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to open %s: %s", path, sf_strerror(NULL));
+        return NULL;
+    }
+
+    spec->format = PA_SAMPLE_FLOAT32LE;
+    spec->rate = info.samplerate;
+    spec->channels = info.channels;
+
+    if (!pa_sample_spec_valid(spec)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Unsupported sample format in %s", path);
+        sf_close(sf);
+        return NULL;
+    }
+
+    /* not every container knows the number of frames up front */
+    buffer = g_array_new(FALSE, FALSE, sizeof(float));
+    *frames = 0;
+
+    do {
+        g_array_set_size(buffer, (*frames + DECODE_CHUNK_FRAMES) * info.channels);
+        read = sf_readf_float(sf, &g_array_index(buffer, float, *frames * info.channels), DECODE_CHUNK_FRAMES);
+        if (read > 0)
+            *frames += read;
+    } while (read == DECODE_CHUNK_FRAMES);
+
+    sf_close(sf);
+
+    return (float*) g_array_free(buffer, FALSE);
+#else
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                "Can't decode %s, built without support for compressed samples", path);
+    return NULL;
+#endif
+}
+
+static void wav_fill_header(guint8 *header, const pa_sample_spec *spec, guint32 length)
+{
+    guint16 frame_size = pa_frame_size(spec);
+
+    memcpy(header, "RIFF", 4);
+    write_le32(header + 4, 36 + length);
+    memcpy(header + 8, "WAVE", 4);
+    memcpy(header + 12, "fmt ", 4);
+    write_le32(header + 16, 16);
+    write_le16(header + 20, spec->format == PA_SAMPLE_FLOAT32LE ? WAV_FORMAT_FLOAT : WAV_FORMAT_PCM);
+    write_le16(header + 22, spec->channels);
+    write_le32(header + 24, spec->rate);
+    write_le32(header + 28, spec->rate * frame_size);
+    write_le16(header + 32, frame_size);
+    write_le16(header + 34, pa_sample_size(spec) * 8);
+    memcpy(header + 36, "data", 4);
+    write_le32(header + 40, length);
+}
+
+static bool sample_file_write_wav(const char *path, const pa_sample_spec *spec,
+                                  const void *data, size_t length, GError **error)
+{
+    guint8 header[WAV_HEADER_LENGTH];
+    bool success = true;
+    FILE *fp;
+
+    fp = fopen(path, "wb");
+    if (!fp) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to create %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    wav_fill_header(header, spec, length);
+
+    if (fwrite(header, 1, sizeof(header), fp) != sizeof(header) ||
+        fwrite(data, 1, length, fp) != length)
+        success = false;
+
+    if (fclose(fp) != 0)
+        success = false;
+
+    if (!success)
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to write %s", path);
+
+    return success;
+}
+
+/* Picks the source channel(s) for every output channel. Mono is spread to all
+ * channels, anything else which doesn't match is mixed down to mono first. */
+static void remix_channel(const float *input, size_t frames, unsigned int input_channels,
+                          unsigned int output_channels, unsigned int channel, float *output)
+{
+    size_t n;
+    unsigned int c;
+    float sum;
+
+    if (input_channels == output_channels || input_channels == 1) {
+        channel = input_channels == 1 ? 0 : channel;
+        for (n = 0; n < frames; n++)
+            output[n] = input[n * input_channels + channel];
+        return;
+    }
+
+    for (n = 0; n < frames; n++) {
+        sum = 0.0f;
+        for (c = 0; c < input_channels; c++)
+            sum += input[n * input_channels + c];
+        output[n] = sum / input_channels;
+    }
+}
+
+static void *convert(const float *input, size_t frames, const pa_sample_spec *input_spec,
+                     const pa_sample_spec *output_spec, double gain, size_t *length)
+{
+    Resampler *resampler = 0;
+    size_t output_frames = frames, n;
+    float *planar, *resampled;
+    unsigned int channel;
+    guint8 *output;
+    float value, factor;
+
+    factor = pow(10.0, gain / 20.0);
+
+    if (input_spec->rate != output_spec->rate) {
+        resampler = new Resampler(input_spec->rate, output_spec->rate);
+        output_frames = resampler->output_frames(frames);
+    }
+
+    *length = output_frames * pa_frame_size(output_spec);
+    output = (guint8*) g_malloc(*length);
+
+    planar = g_new(float, frames);
+    resampled = resampler ? g_new(float, output_frames) : planar;
+
+    for (channel = 0; channel < output_spec->channels; channel++) {
+        remix_channel(input, frames, input_spec->channels, output_spec->channels, channel, planar);
+
+        if (resampler)
+            resampler->process(planar, frames, resampled);
+
+        for (n = 0; n < output_frames; n++) {
+            value = resampled[n] * factor;
+
+            if (output_spec->format == PA_SAMPLE_FLOAT32LE) {
+                memcpy(output + (n * output_spec->channels + channel) * 4, &value, 4);
+                continue;
+            }
+
+            value = CLAMP(value, -1.0f, 32767.0f / 32768.0f);
+            write_le16(output + (n * output_spec->channels + channel) * 2, (gint16) lrintf(value * 32768.0f));
+        }
+    }
+
+    if (resampled != planar)
+        g_free(resampled);
+    g_free(planar);
+    delete resampler;
+
+    return output;
+}
+
+/* Converted files are named after the sample and the content of its source.
+ * Once a sample changed, the ones converted from its earlier content are of
+ * no use anymore. */
+static void sample_file_prune_cache(const char *cache_dir, const char *path, const char *hash)
+{
+    char *basename, *name, *prefix, *stale_path;
+    const char *filename, *file_hash;
+    GDir *dir;
+
+    basename = g_path_get_basename(path);
+    name = sample_file_strip_suffix(basename);
+    g_free(basename);
+
+    if (!name)
+        return;
+
+    dir = g_dir_open(cache_dir, 0, NULL);
+    if (!dir) {
+        g_free(name);
+        return;
+    }
+
+    prefix = g_strdup_printf("%s-", name);
+
+    while ((filename = g_dir_read_name(dir)) != NULL) {
+        if (!g_str_has_prefix(filename, prefix))
+            continue;
+
+        /* the name of another sample might start with ours */
+        file_hash = filename + strlen(prefix);
+        if (strspn(file_hash, "0123456789abcdef") != HASH_LENGTH || file_hash[HASH_LENGTH] != '-' ||
+            strncmp(file_hash, hash, HASH_LENGTH) == 0)
+            continue;
+
+        stale_path = g_build_filename(cache_dir, filename, NULL);
+        if (unlink(stale_path) == 0)
+            g_message("Removed outdated converted sample %s", stale_path);
+        g_free(stale_path);
+    }
+
+    g_dir_close(dir);
+    g_free(prefix);
+    g_free(name);
+}
+
+/* Converts the sample at path into a WAV file within cache_dir and returns the
+ * path of that file. Without a target the sample is only decoded, otherwise it
+ * is also resampled and remixed to the target rate and channels. A gain in dB
+ * other than 0 is applied to the converted data. The cached file is named after
+ * the sample, the content of its source, the format it was converted to and
+ * the gain so this only ever happens once. This blocks and is meant to be run
+ * on a worker thread. */
+char* sample_file_convert(const char *path, const pa_sample_spec *target, double gain,
+                          const char *cache_dir, GError **error)
+{
+    pa_sample_spec input_spec, output_spec;
+    char *basename, *name, *hash, *cache_path, *tmp_path;
+    char gain_suffix[16] = "";
+    float *input;
+    void *output;
+    size_t frames, length;
+    bool success;
+
+    hash = sample_file_compute_hash(path, error);
+    if (!hash)
+        return NULL;
+
+    /* the header tells us all we need to find an earlier conversion */
+    if (target) {
+        sample_file_converted_spec(target, &output_spec);
+    }
+    else if (sample_file_read_spec(path, &output_spec, error)) {
+        output_spec.format = PA_SAMPLE_S16LE;
+    }
+    else {
+        g_free(hash);
+        return NULL;
+    }
+
+    basename = g_path_get_basename(path);
+    name = sample_file_strip_suffix(basename);
+    if (gain != 0.0)
+        snprintf(gain_suffix, sizeof(gain_suffix), "-%+.1fdB", gain);
+
+    cache_path = g_strdup_printf("%s/%s-%s-%s-%u-%u%s.wav", cache_dir, name ? name : basename, hash,
+                                 pa_sample_format_to_string(output_spec.format),
+                                 output_spec.rate, output_spec.channels, gain_suffix);
+    g_free(name);
+    g_free(basename);
+
+    if (g_file_test(cache_path, G_FILE_TEST_IS_REGULAR)) {
+        g_free(hash);
+        return cache_path;
+    }
+
+    if (g_mkdir_with_parents(cache_dir, 0755) != 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to create %s: %s", cache_dir, strerror(errno));
+        g_free(hash);
+        g_free(cache_path);
+        return NULL;
+    }
+
+    input = sample_file_read_float(path, &input_spec, &frames, error);
+    if (!input) {
+        g_free(hash);
+        g_free(cache_path);
+        return NULL;
+    }
+
+    output = convert(input, frames, &input_spec, &output_spec, gain, &length);
+    g_free(input);
+
+    /* never leave a partially written file behind under the final name */
+    tmp_path = g_strdup_printf("%s.tmp", cache_path);
+
+    success = sample_file_write_wav(tmp_path, &output_spec, output, length, error);
+    g_free(output);
+
+    if (success && rename(tmp_path, cache_path) != 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to store converted sample %s: %s",
+                    path, strerror(errno));
+        success = false;
+    }
+
+    if (success) {
+        sample_file_prune_cache(cache_dir, path, hash);
+    }
+    else {
+        unlink(tmp_path);
+        g_free(cache_path);
+        cache_path = NULL;
+    }
+
+    g_free(tmp_path);
+    g_free(hash);
+
+    return cache_path;
+}
+
+/* Copies a sample which can be uploaded as it is into cache_dir so we can map
+ * it. The system sounds get replaced by updates while we run, our copy is only
+ * ever replaced by renaming a new one over it. The copy is named after the
+ * sample and its content like the converted ones. This blocks and is meant to
+ * be run on a worker thread. */
+char* sample_file_copy(const char *path, const char *cache_dir, GError **error)
+{
+    char *contents, *basename, *name, *hash, *cache_path;
+    const char *suffix;
+    gsize length;
+
+    if (!g_file_get_contents(path, &contents, &length, error))
+        return NULL;
+
+    hash = g_compute_checksum_for_data(G_CHECKSUM_SHA1, (const guint8*) contents, length);
+
+    /* the suffix tells raw samples from WAV files */
+    basename = g_path_get_basename(path);
+    name = sample_file_strip_suffix(basename);
+    suffix = strrchr(basename, '.');
+
+    cache_path = g_strdup_printf("%s/%s-%s-copy%s", cache_dir, name ? name : basename, hash,
+                                 suffix ? suffix : "");
+    g_free(name);
+    g_free(basename);
+
+    if (!g_file_test(cache_path, G_FILE_TEST_IS_REGULAR)) {
+        if (g_mkdir_with_parents(cache_dir, 0755) != 0) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to create %s: %s",
+                        cache_dir, strerror(errno));
+            g_free(cache_path);
+            cache_path = NULL;
+        }
+        /* writes a temporary file and renames it over the final name */
+        else if (g_file_set_contents(cache_path, contents, length, error)) {
+            sample_file_prune_cache(cache_dir, path, hash);
+        }
+        else {
+            g_free(cache_path);
+            cache_path = NULL;
+        }
+    }
+
+    g_free(hash);
+    g_free(contents);
+
+    return cache_path;
+}
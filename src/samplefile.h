@@ -0,0 +1,42 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef SAMPLEFILE_H
+#define SAMPLEFILE_H
+
+#include <glib.h>
+#include <pulse/pulseaudio.h>
+
+struct SampleFile {
+    pa_sample_spec spec;
+    /* position and size of the raw sample data within the file */
+    size_t offset;
+    size_t length;
+};
+
+char* sample_file_strip_suffix(const char *filename);
+char* sample_file_find(const char *directory, const char *name);
+bool sample_file_open(const char *path, SampleFile *file);
+void sample_file_converted_spec(const pa_sample_spec *target, pa_sample_spec *spec);
+void sample_file_decode(const guint8 *data, size_t samples, pa_sample_format_t format, float *output);
+bool sample_file_needs_conversion(const char *path, const pa_sample_spec *target);
+char* sample_file_convert(const char *path, const pa_sample_spec *target, double gain,
+                          const char *cache_dir, GError **error);
+char* sample_file_copy(const char *path, const char *cache_dir, GError **error);
+
+#endif // SAMPLEFILE_H
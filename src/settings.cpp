@@ -0,0 +1,106 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include "settings.h"
+
+Settings::Settings() :
+    mKeyFile(0)
+{
+    mKeyFile = g_key_file_new();
+}
+
+Settings::~Settings()
+{
+    g_key_file_free(mKeyFile);
+}
+
+void Settings::load(const char *path)
+{
+    GError *error = NULL;
+
+    if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
+        g_message("No configuration found at %s, using defaults", path);
+        return;
+    }
+
+    if (!g_key_file_load_from_file(mKeyFile, path, G_KEY_FILE_NONE, &error)) {
+        g_warning("Failed to load configuration from %s: %s", path, error->message);
+        g_error_free(error);
+        return;
+    }
+
+    g_message("Loaded configuration from %s", path);
+}
+
+int Settings::get_integer(const char *group, const char *key, int default_value) const
+{
+    GError *error = NULL;
+    int value;
+
+    value = g_key_file_get_integer(mKeyFile, group, key, &error);
+    if (error) {
+        g_error_free(error);
+        return default_value;
+    }
+
+    return value;
+}
+
+bool Settings::get_boolean(const char *group, const char *key, bool default_value) const
+{
+    GError *error = NULL;
+    gboolean value;
+
+    value = g_key_file_get_boolean(mKeyFile, group, key, &error);
+    if (error) {
+        g_error_free(error);
+        return default_value;
+    }
+
+    return value;
+}
+
+double Settings::get_double(const char *group, const char *key, double default_value) const
+{
+    GError *error = NULL;
+    double value;
+
+    value = g_key_file_get_double(mKeyFile, group, key, &error);
+    if (error) {
+        g_error_free(error);
+        return default_value;
+    }
+
+    return value;
+}
+
+char* Settings::get_string(const char *group, const char *key, const char *default_value) const
+{
+    char *value;
+
+    value = g_key_file_get_string(mKeyFile, group, key, NULL);
+    if (!value)
+        return g_strdup(default_value);
+
+    return value;
+}
+
+char** Settings::get_string_list(const char *group, const char *key) const
+{
+    return g_key_file_get_string_list(mKeyFile, group, key, NULL, NULL);
+}
@@ -0,0 +1,42 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <glib.h>
+
+class Settings
+{
+public:
+    Settings();
+    ~Settings();
+
+    void load(const char *path);
+
+    int get_integer(const char *group, const char *key, int default_value) const;
+    bool get_boolean(const char *group, const char *key, bool default_value) const;
+    double get_double(const char *group, const char *key, double default_value) const;
+    char* get_string(const char *group, const char *key, const char *default_value) const;
+    char** get_string_list(const char *group, const char *key) const;
+
+private:
+    GKeyFile *mKeyFile;
+};
+
+#endif // SETTINGS_H
@@ -0,0 +1,191 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <string.h>
+
+#include "statestore.h"
+
+/* Time in milliseconds changes are collected before writing them */
+#define STATE_SAVE_DELAY	500
+
+#define BOOT_ID_PATH		"/proc/sys/kernel/random/boot_id"
+
+StateStore::StateStore(const char *path) :
+    mPath(g_strdup(path)),
+    mKeyFile(0),
+    mBootId(0),
+    mWritten(0),
+    mPreviousBoot(false),
+    mSaveTimeout(0)
+{
+    mKeyFile = g_key_file_new();
+
+    if (g_file_get_contents(BOOT_ID_PATH, &mBootId, NULL, NULL))
+        g_strstrip(mBootId);
+}
+
+StateStore::~StateStore()
+{
+    flush();
+
+    g_key_file_free(mKeyFile);
+    g_free(mPath);
+    g_free(mBootId);
+    g_free(mWritten);
+}
+
+bool StateStore::load()
+{
+    GError *error = NULL;
+    char *boot_id;
+
+    if (!g_file_get_contents(mPath, &mWritten, NULL, NULL))
+        return false;
+
+    if (!g_key_file_load_from_data(mKeyFile, mWritten, -1, G_KEY_FILE_NONE, &error)) {
+        g_warning("Ignoring broken audio state snapshot %s: %s", mPath, error->message);
+        g_error_free(error);
+        return false;
+    }
+
+    boot_id = g_key_file_get_string(mKeyFile, "State", "BootId", NULL);
+    /* without a boot id on either side we can't tell, assume a reboot */
+    mPreviousBoot = !boot_id || !mBootId || strcmp(boot_id, mBootId) != 0;
+    g_free(boot_id);
+
+    g_message("Restored audio state from %s", mPath);
+
+    return true;
+}
+
+int StateStore::get_integer(const char *group, const char *key, int default_value) const
+{
+    GError *error = NULL;
+    int value;
+
+    value = g_key_file_get_integer(mKeyFile, group, key, &error);
+    if (error) {
+        g_error_free(error);
+        return default_value;
+    }
+
+    return value;
+}
+
+bool StateStore::get_boolean(const char *group, const char *key, bool default_value) const
+{
+    GError *error = NULL;
+    gboolean value;
+
+    value = g_key_file_get_boolean(mKeyFile, group, key, &error);
+    if (error) {
+        g_error_free(error);
+        return default_value;
+    }
+
+    return value;
+}
+
+double StateStore::get_double(const char *group, const char *key, double default_value) const
+{
+    GError *error = NULL;
+    double value;
+
+    value = g_key_file_get_double(mKeyFile, group, key, &error);
+    if (error) {
+        g_error_free(error);
+        return default_value;
+    }
+
+    return value;
+}
+
+void StateStore::set_integer(const char *group, const char *key, int value)
+{
+    g_key_file_set_integer(mKeyFile, group, key, value);
+}
+
+void StateStore::set_boolean(const char *group, const char *key, bool value)
+{
+    g_key_file_set_boolean(mKeyFile, group, key, value);
+}
+
+void StateStore::set_double(const char *group, const char *key, double value)
+{
+    g_key_file_set_double(mKeyFile, group, key, value);
+}
+
+void StateStore::save()
+{
+    if (mSaveTimeout)
+        return;
+
+    mSaveTimeout = g_timeout_add(STATE_SAVE_DELAY, [] (gpointer user_data) -> gboolean {
+        StateStore *store = static_cast<StateStore*>(user_data);
+
+        store->mSaveTimeout = 0;
+        store->write();
+
+        return FALSE;
+    }, this);
+}
+
+void StateStore::flush()
+{
+    if (!mSaveTimeout)
+        return;
+
+    g_source_remove(mSaveTimeout);
+    mSaveTimeout = 0;
+
+    write();
+}
+
+void StateStore::write()
+{
+    GError *error = NULL;
+    char *data, *dir;
+
+    if (mBootId)
+        g_key_file_set_string(mKeyFile, "State", "BootId", mBootId);
+
+    data = g_key_file_to_data(mKeyFile, NULL, NULL);
+
+    /* most changes end up where they started, e.g. a volume moved back and
+     * forth, no need to touch the disk for them */
+    if (g_strcmp0(data, mWritten) == 0) {
+        g_free(data);
+        return;
+    }
+
+    dir = g_path_get_dirname(mPath);
+    g_mkdir_with_parents(dir, 0755);
+    g_free(dir);
+
+    /* goes to a temporary file renamed over the old one, a crash leaves
+     * either the old or the new snapshot */
+    if (!g_file_set_contents(mPath, data, -1, &error)) {
+        g_warning("Failed to save audio state to %s: %s", mPath, error->message);
+        g_error_free(error);
+        g_free(data);
+        return;
+    }
+
+    g_free(mWritten);
+    mWritten = data;
+}
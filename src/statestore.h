@@ -0,0 +1,62 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef STATESTORE_H
+#define STATESTORE_H
+
+#include <glib.h>
+
+/* Snapshot of the audio state on disk so a restarted service can answer
+ * right away instead of starting from nothing. Changes are written with a
+ * small delay so a burst of them ends up as a single write, which replaces
+ * the previous snapshot atomically. */
+class StateStore
+{
+public:
+    explicit StateStore(const char *path);
+    ~StateStore();
+
+    /* Returns false if there is no usable snapshot */
+    bool load();
+    /* The snapshot was written before the system last booted */
+    bool from_previous_boot() const { return mPreviousBoot; }
+
+    int get_integer(const char *group, const char *key, int default_value) const;
+    bool get_boolean(const char *group, const char *key, bool default_value) const;
+    double get_double(const char *group, const char *key, double default_value) const;
+
+    void set_integer(const char *group, const char *key, int value);
+    void set_boolean(const char *group, const char *key, bool value);
+    void set_double(const char *group, const char *key, double value);
+
+    /* Writes the values set so far once things settled down */
+    void save();
+    void flush();
+
+private:
+    char *mPath;
+    GKeyFile *mKeyFile;
+    char *mBootId;
+    char *mWritten;
+    bool mPreviousBoot;
+    guint mSaveTimeout;
+
+    void write();
+};
+
+#endif // STATESTORE_H
@@ -0,0 +1,146 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "volumecurve.h"
+
+/* Range of the dB curve, the first step above silence sits just above it */
+#define CURVE_DB_RANGE		60.0
+#define CURVE_LN10		2.302585092994046
+
+namespace {
+
+/* The C++11 way of generating a table from its indexes */
+template<unsigned int... I> struct index_list {};
+template<unsigned int N, unsigned int... I> struct make_index_list : make_index_list<N - 1, N - 1, I...> {};
+template<unsigned int... I> struct make_index_list<0, I...> { typedef index_list<I...> type; };
+
+struct VolumeTable {
+    pa_volume_t values[VOLUME_CURVE_STEPS + 1];
+};
+
+/* constexpr functions can't call into libm, the arguments stay within [-2.5;1]
+ * where a few dozen rounds are exact to the last bit of a pa_volume_t */
+constexpr double exp_series(double x, unsigned int n, double term, double sum)
+{
+    return n > 40 ? sum : exp_series(x, n + 1, term * x / n, sum + term * x / n);
+}
+
+constexpr double const_exp(double x)
+{
+    return exp_series(x, 1, 1.0, 1.0);
+}
+
+constexpr double cbrt_newton(double x, double y, unsigned int rounds)
+{
+    return rounds == 0 ? y : cbrt_newton(x, y - (y * y * y - x) / (3.0 * y * y), rounds - 1);
+}
+
+constexpr double const_cbrt(double x)
+{
+    return x <= 0.0 ? 0.0 : cbrt_newton(x, 1.0, 40);
+}
+
+/* pulseaudio volumes are the cube root of the amplitude factor, which is
+ * why the dB curve has 60 instead of 20 in the exponent */
+constexpr double curve_value(VolumeCurveType type, double step)
+{
+    return type == VOLUME_CURVE_LINEAR ? const_cbrt(step) :
+           type == VOLUME_CURVE_DB ? (step <= 0.0 ? 0.0 : const_exp(CURVE_DB_RANGE * (step - 1.0) / 60.0 * CURVE_LN10)) :
+           step;
+}
+
+constexpr pa_volume_t curve_volume(VolumeCurveType type, unsigned int step)
+{
+    return (pa_volume_t) (curve_value(type, (double) step / VOLUME_CURVE_STEPS) * PA_VOLUME_NORM + 0.5);
+}
+
+template<unsigned int... I>
+constexpr VolumeTable make_table(VolumeCurveType type, index_list<I...>)
+{
+    return {{ curve_volume(type, I)... }};
+}
+
+/* indexed by VolumeCurveType */
+constexpr VolumeTable tables[] = {
+    make_table(VOLUME_CURVE_CUBIC, make_index_list<VOLUME_CURVE_STEPS + 1>::type()),
+    make_table(VOLUME_CURVE_LINEAR, make_index_list<VOLUME_CURVE_STEPS + 1>::type()),
+    make_table(VOLUME_CURVE_DB, make_index_list<VOLUME_CURVE_STEPS + 1>::type())
+};
+
+static_assert(tables[VOLUME_CURVE_CUBIC].values[VOLUME_CURVE_STEPS] == PA_VOLUME_NORM &&
+              tables[VOLUME_CURVE_LINEAR].values[VOLUME_CURVE_STEPS] == PA_VOLUME_NORM &&
+              tables[VOLUME_CURVE_DB].values[VOLUME_CURVE_STEPS] == PA_VOLUME_NORM,
+              "volume curves must end at PA_VOLUME_NORM");
+
+const char *curve_names[] = {
+    "cubic",
+    "linear",
+    "db"
+};
+
+}
+
+bool volume_curve_parse(const char *value, size_t length, VolumeCurveType *type)
+{
+    unsigned int n;
+
+    if (!value)
+        return false;
+
+    for (n = 0; n < G_N_ELEMENTS(curve_names); n++) {
+        if (strlen(curve_names[n]) == length && strncmp(curve_names[n], value, length) == 0) {
+            *type = (VolumeCurveType) n;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+VolumeCurve::VolumeCurve(VolumeCurveType type) :
+    mTable(tables[type].values)
+{
+}
+
+pa_volume_t VolumeCurve::to_volume(int step) const
+{
+    return mTable[CLAMP(step, 0, VOLUME_CURVE_STEPS)];
+}
+
+int VolumeCurve::to_step(pa_volume_t volume) const
+{
+    unsigned int low = 0, high = VOLUME_CURVE_STEPS;
+
+    if (volume >= mTable[VOLUME_CURVE_STEPS])
+        return VOLUME_CURVE_STEPS;
+
+    /* the table grows strictly, find the two steps around volume */
+    while (high - low > 1) {
+        unsigned int middle = (low + high) / 2;
+
+        if (mTable[middle] <= volume)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    return volume - mTable[low] <= mTable[high] - volume ? low : high;
+}
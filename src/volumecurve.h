@@ -0,0 +1,54 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef VOLUMECURVE_H
+#define VOLUMECURVE_H
+
+#include <stddef.h>
+#include <pulse/pulseaudio.h>
+
+/* Number of steps of the volume scale exposed through the service */
+#define VOLUME_CURVE_STEPS	100
+
+enum VolumeCurveType {
+    /* pulseaudio's own scale, the amplitude grows with the cube */
+    VOLUME_CURVE_CUBIC,
+    /* amplitude proportional to the volume */
+    VOLUME_CURVE_LINEAR,
+    /* equal steps in dB over a range of 60dB */
+    VOLUME_CURVE_DB
+};
+
+bool volume_curve_parse(const char *value, size_t length, VolumeCurveType *type);
+
+/* Maps the 0-100 volume scale to pulseaudio volumes and back. All values are
+ * precomputed at compile time. Mapping back picks the nearest step so every
+ * volume we set comes back as the very same step. */
+class VolumeCurve
+{
+public:
+    explicit VolumeCurve(VolumeCurveType type);
+
+    pa_volume_t to_volume(int step) const;
+    int to_step(pa_volume_t volume) const;
+
+private:
+    const pa_volume_t *mTable;
+};
+
+#endif // VOLUMECURVE_H
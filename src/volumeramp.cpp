@@ -0,0 +1,135 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <math.h>
+#include <string.h>
+
+#include "volumeramp.h"
+
+/* One step per frame at 60Hz is plenty for the ear and for pulseaudio */
+#define RAMP_INTERVAL_MSEC	16
+/* Silence in the dB curve, it can't start or end at minus infinity */
+#define RAMP_DB_FLOOR		-60.0
+
+static const char *curve_names[] = {
+    "linear",
+    "db",
+    "scurve"
+};
+
+bool volume_ramp_curve_parse(const char *value, size_t length, VolumeRampCurve *curve)
+{
+    unsigned int n;
+
+    if (!value)
+        return false;
+
+    for (n = 0; n < G_N_ELEMENTS(curve_names); n++) {
+        if (strlen(curve_names[n]) == length && strncmp(curve_names[n], value, length) == 0) {
+            *curve = (VolumeRampCurve) n;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+VolumeRamp::VolumeRamp(pa_volume_t from, pa_volume_t to, unsigned int duration, VolumeRampCurve curve,
+                       VolumeRampStepCallback callback) :
+    mFrom(from),
+    mTo(to),
+    mStart(0),
+    mDuration((gint64) duration * 1000),
+    mCurve(curve),
+    mCallback(callback),
+    mLast(from),
+    mTimeout(0)
+{
+}
+
+VolumeRamp::~VolumeRamp()
+{
+    if (mTimeout)
+        g_source_remove(mTimeout);
+}
+
+void VolumeRamp::start()
+{
+    mStart = g_get_monotonic_time();
+
+    if (!step())
+        return;
+
+    mTimeout = g_timeout_add(RAMP_INTERVAL_MSEC, step_cb, this);
+}
+
+pa_volume_t VolumeRamp::value_at(double progress) const
+{
+    double from, to;
+
+    switch (mCurve) {
+    case VOLUME_RAMP_CURVE_DB:
+        /* equal loudness changes per step sound the most even */
+        from = mFrom > PA_VOLUME_MUTED ? MAX(pa_sw_volume_to_dB(mFrom), RAMP_DB_FLOOR) : RAMP_DB_FLOOR;
+        to = mTo > PA_VOLUME_MUTED ? MAX(pa_sw_volume_to_dB(mTo), RAMP_DB_FLOOR) : RAMP_DB_FLOOR;
+
+        return pa_sw_volume_from_dB(from + (to - from) * progress);
+    case VOLUME_RAMP_CURVE_SCURVE:
+        /* smoothstep, starts and ends gently */
+        progress = progress * progress * (3.0 - 2.0 * progress);
+        break;
+    case VOLUME_RAMP_CURVE_LINEAR:
+    default:
+        break;
+    }
+
+    return (pa_volume_t) ((double) mFrom + ((double) mTo - (double) mFrom) * progress);
+}
+
+/* Returns whether further steps follow */
+bool VolumeRamp::step()
+{
+    double progress;
+    pa_volume_t value;
+
+    if (mDuration > 0)
+        progress = MIN((double) (g_get_monotonic_time() - mStart) / mDuration, 1.0);
+    else
+        progress = 1.0;
+
+    if (progress >= 1.0) {
+        mTimeout = 0;
+        mCallback(mTo, true);
+        return false;
+    }
+
+    value = value_at(progress);
+    if (value != mLast) {
+        mLast = value;
+        mCallback(value, false);
+    }
+
+    return true;
+}
+
+gboolean VolumeRamp::step_cb(gpointer user_data)
+{
+    VolumeRamp *ramp = static_cast<VolumeRamp*>(user_data);
+
+    return ramp->step() ? TRUE : FALSE;
+}
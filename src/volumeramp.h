@@ -0,0 +1,69 @@
+/* @@@LICENSE
+*
+* Copyright (c) 2013-2015 Simon Busch <morphis@gravedo.de>
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef VOLUMERAMP_H
+#define VOLUMERAMP_H
+
+#include <stddef.h>
+#include <functional>
+#include <glib.h>
+#include <pulse/pulseaudio.h>
+
+enum VolumeRampCurve {
+    VOLUME_RAMP_CURVE_LINEAR,
+    VOLUME_RAMP_CURVE_DB,
+    VOLUME_RAMP_CURVE_SCURVE
+};
+
+bool volume_ramp_curve_parse(const char *value, size_t length, VolumeRampCurve *curve);
+
+/* Called for every step with the volume to apply, last is set for the final
+ * one. The ramp must not be deleted from within the callback, it is done
+ * with the timer once the final step returned. */
+typedef std::function<void(pa_volume_t, bool)> VolumeRampStepCallback;
+
+/* Moves the volume from one value to another over time. Steps are clocked
+ * by a timer but computed from the time actually passed, so a late timer
+ * makes the ramp skip ahead instead of getting longer. */
+class VolumeRamp
+{
+public:
+    VolumeRamp(pa_volume_t from, pa_volume_t to, unsigned int duration, VolumeRampCurve curve,
+               VolumeRampStepCallback callback);
+    ~VolumeRamp();
+
+    void start();
+    pa_volume_t target() const { return mTo; }
+
+private:
+    pa_volume_t mFrom;
+    pa_volume_t mTo;
+    gint64 mStart;
+    gint64 mDuration;
+    VolumeRampCurve mCurve;
+    VolumeRampStepCallback mCallback;
+    pa_volume_t mLast;
+    guint mTimeout;
+
+    pa_volume_t value_at(double progress) const;
+    bool step();
+
+    static gboolean step_cb(gpointer user_data);
+};
+
+#endif // VOLUMERAMP_H